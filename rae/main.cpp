@@ -6,9 +6,14 @@
 //  Copyright © 2015 Abraham Schneider. All rights reserved.
 //
 
+#include <algorithm>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <armadillo>
 #include <string>
+#include <thread>
+#include <vector>
 #include <boost/variant.hpp>
 
 #include "module.hpp"
@@ -19,6 +24,9 @@
 #include "concat.hpp"
 #include "reshape.hpp"
 #include "activation.hpp"
+#include "tree.hpp"
+#include "context.hpp"
+#include "server.hpp"
 
 using namespace gnol;
 
@@ -50,7 +58,7 @@ make_autoencoder(variable<matrix_t> &weight,
         {"encoder_activation", encoder},
         {"encoder", encoder_sigmoid},
         {"decoder_activation", decoder},
-        {"decoder", decoder},
+        {"decoder", decoder_sigmoid},
         {"error", error}
     });
     
@@ -59,6 +67,67 @@ make_autoencoder(variable<matrix_t> &weight,
     return std::move(autoencoder);
 }
 
+// serves the encoder of the autoencoders to many callers at once, each
+// waiting on its request before sending the next, and reports latency
+// and throughput for a few batching policies
+void benchmark_serving(variable<matrix_t> &weight, variable<matrix_t> &grad_weight) {
+    typedef std::chrono::steady_clock clock;
+    
+    shared_model encoder([&]() -> shared_model::module_ptr {
+        return make_sequence({
+            make_module<LinearModule>(share(weight), share(grad_weight)),
+            make_module<SigmoidModule>(weight->n_cols)
+        });
+    });
+    
+    const std::size_t clients = 32, requests = 500;
+    const batching_policy policies[] = {
+        batching_policy(1, std::chrono::microseconds(0)),
+        batching_policy(8, std::chrono::microseconds(100)),
+        batching_policy(32, std::chrono::microseconds(500)),
+        batching_policy(64, std::chrono::microseconds(2000))
+    };
+    
+    for (const auto &policy : policies) {
+        std::vector<double> latencies(clients*requests);
+        std::size_t batches;
+        
+        const auto start = clock::now();
+        {
+            BatchingServer server(encoder, policy);
+            
+            std::vector<std::thread> threads;
+            for (std::size_t i = 0; i < clients; i++) {
+                threads.emplace_back([&, i]() {
+                    vector_t input(weight->n_rows);
+                    input.randu();
+                    
+                    for (std::size_t k = 0; k < requests; k++) {
+                        const auto sent = clock::now();
+                        server.submit(input).get();
+                        latencies[i*requests + k] =
+                            std::chrono::duration<double, std::micro>(clock::now() - sent).count();
+                    }
+                });
+            }
+            
+            for (auto &t : threads)
+                t.join();
+            
+            batches = server.get_batches();
+        }
+        const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "batch " << policy.max_batch
+                  << ", deadline " << policy.max_delay.count() << "us: "
+                  << "p50 " << latencies[latencies.size()/2] << "us, "
+                  << "p99 " << latencies[latencies.size()*99/100] << "us, "
+                  << latencies.size()/elapsed << " requests/s, "
+                  << double(latencies.size())/batches << " per batch" << std::endl;
+    }
+}
+
 int main(int argc, const char * argv[]) {
     // S = ((a b) (c d))
     
@@ -66,6 +135,12 @@ int main(int argc, const char * argv[]) {
     variable<matrix_t> weight(size(10, 5));
     variable<matrix_t> grad_weight(size(10, 5));
     
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-serving") {
+        weight->randu();
+        benchmark_serving(weight, grad_weight);
+        return 0;
+    }
+    
     // (a b)
     auto ae1 = make_autoencoder(weight, grad_weight);
     auto ae2 = make_autoencoder(weight, grad_weight);
@@ -85,5 +160,40 @@ int main(int argc, const char * argv[]) {
     
     std::cout << output << std::endl;
     
+    // the same kind of encoder applied recursively over a batch of trees,
+    // with every node at the same height encoded by one matrix product
+    TreeBatcher batcher({[]() -> TreeBatcher::module_ptr {
+        return make_sequence({
+            make_module<LinearModule>(size(10, 5)),
+            make_module<SigmoidModule>(5)
+        });
+    }});
+    
+    // ((a b) (c d)) and (e f)
+    tree_batch trees;
+    auto ab = trees.add_node(trees.add_leaf(0), trees.add_leaf(1));
+    auto cd = trees.add_node(trees.add_leaf(2), trees.add_leaf(3));
+    trees.add_node(ab, cd);
+    trees.add_node(trees.add_leaf(4), trees.add_leaf(5));
+    
+    matrix_t leaves(5, 6);
+    leaves.randu();
+    
+    std::cout << batcher.forward(trees, leaves) << std::endl;
+    
+    // or let the autoencoder pick the tree, greedily merging the pair it
+    // reconstructs best
+    auto encoder = make_sequence({
+        make_module<LinearModule>(size(10, 5)),
+        make_module<SigmoidModule>(5)
+    });
+    auto decoder = make_module<LinearModule>(size(5, 10));
+    
+    GreedyMerger merger(encoder, decoder);
+    tree_batch greedy;
+    merger.build(leaves, greedy);
+    
+    std::cout << batcher.forward(greedy, leaves) << std::endl;
+    
     return 0;
 }
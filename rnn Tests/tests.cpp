@@ -6,8 +6,19 @@
 //  Copyright (c) 2015 Abraham Schneider. All rights reserved.
 //
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
@@ -165,6 +176,23 @@ TEST(LinearModule, GradCheck) {
     test_gradient2(linear);
 }
 
+TEST(LinearModule, BatchForward) {
+    LinearModule linear({4, 3});
+    
+    // each column is a separate sample
+    matrix_t input(4, 6);
+    input.randu();
+    matrix_t output = linear.forward(input);
+    
+    ASSERT_EQ(output.n_rows, 3);
+    ASSERT_EQ(output.n_cols, 6);
+    
+    for (std::size_t i = 0; i < input.n_cols; i++) {
+        matrix_t expected = linear.forward(input.col(i));
+        ASSERT_TRUE(is_close(output.col(i), expected));
+    }
+}
+
 TEST(SequenceModule, Initialize) {
     auto linear =
         make_module<LinearModule>(size(3, 5));
@@ -181,6 +209,152 @@ TEST(SequenceModule, GradCheck) {
     test_gradient2(seq);
 }
 
+TEST(SequenceModule, BatchBackward) {
+    auto linear = make_module<LinearModule>(size(4, 3));
+    auto sigmoid = make_module<SigmoidModule>(3);
+    SequenceModule seq({linear, sigmoid});
+    
+    matrix_t input(4, 5), grad_output(3, 5);
+    input.randu();
+    grad_output.randu();
+    
+    seq.clear();
+    seq.forward(input);
+    seq.backward(input, grad_output);
+    matrix_t batch_grad_weight = *linear->get_grad_params().weight;
+    matrix_t batch_grad_input = seq.get_grad_input();
+    
+    // the gradient of a batch is the sum of the gradients of each sample,
+    // with one column of grad_input per sample
+    matrix_t grad_weight(4, 3);
+    grad_weight.zeros();
+    for (std::size_t i = 0; i < input.n_cols; i++) {
+        seq.clear();
+        seq.forward(input.col(i));
+        seq.backward(input.col(i), grad_output.col(i));
+        grad_weight += *linear->get_grad_params().weight;
+        ASSERT_TRUE(is_close(batch_grad_input.col(i), seq.get_grad_input()));
+    }
+    
+    ASSERT_TRUE(is_close(batch_grad_weight, grad_weight));
+}
+
+TEST(ActivationModule, Forward) {
+    matrix_t input(7, 3);
+    input.randn();
+    input *= 10;
+    
+    SigmoidModule sigmoid(7);
+    TanhModule tanh(7);
+    ReLUModule relu(7);
+    SoftplusModule softplus(7);
+    
+    ASSERT_TRUE(is_close(sigmoid.forward(input), 1/(1 + exp(-input)), 10e-10));
+    ASSERT_TRUE(is_close(tanh.forward(input), arma::tanh(input), 10e-10));
+    ASSERT_TRUE(is_close(relu.forward(input), clamp(input, 0, input.max()), 10e-10));
+    ASSERT_TRUE(is_close(softplus.forward(input), log(1 + exp(input)), 10e-10));
+}
+
+TEST(kernels, ExpRelativeError) {
+    vector_t input = linspace<vector_t>(-708, 709, 100001);
+    vector_t output(input.n_elem);
+    kernels::exp(input.memptr(), output.memptr(), input.n_elem);
+    
+    for (uword i = 0; i < input.n_elem; i++) {
+        const real_t expected = std::exp(input[i]);
+        ASSERT_LT(std::fabs(output[i] - expected)/expected, 1e-14);
+        ASSERT_LT(std::fabs(kernels::exp(input[i]) - expected)/expected, 1e-14);
+    }
+}
+
+TEST(ActivationModule, GradCheck) {
+    auto linear1 = make_module<LinearModule>(size(3, 5));
+    auto tanh = make_module<TanhModule>(5);
+    auto linear2 = make_module<LinearModule>(size(5, 4));
+    auto softplus = make_module<SoftplusModule>(4);
+    auto linear3 = make_module<LinearModule>(size(4, 2));
+    auto relu = make_module<ReLUModule>(2);
+    
+    SequenceModule seq({linear1, tanh, linear2, softplus, linear3, relu});
+    test_gradient2(seq);
+}
+
+TEST(ActivationModule, Inplace) {
+    auto linear1 = make_module<LinearModule>(size(4, 6));
+    auto tanh = make_module<TanhModule>(6);
+    auto linear2 = make_module<LinearModule>(size(6, 3));
+    auto sigmoid = make_module<SigmoidModule>(3);
+    SequenceModule seq({linear1, tanh, linear2, sigmoid});
+    
+    matrix_t input(4, 5), grad_output(3, 5);
+    input.randu();
+    grad_output.randu();
+    
+    seq.clear();
+    matrix_t output = seq.forward(input);
+    matrix_t grad_input = seq.backward(input, grad_output);
+    matrix_t grad_weight = *linear1->get_grad_params().weight;
+    
+    seq.enable_inplace();
+    ASSERT_TRUE(tanh->is_inplace());
+    ASSERT_TRUE(sigmoid->is_inplace());
+    
+    seq.clear();
+    ASSERT_TRUE(is_close(seq.forward(input), output));
+    ASSERT_TRUE(is_close(seq.backward(input, grad_output), grad_input));
+    ASSERT_TRUE(is_close(*linear1->get_grad_params().weight, grad_weight));
+    
+    // the activation overwrote the output of the layer before it
+    ASSERT_EQ(tanh->get_output()->memptr(), linear1->get_output()->memptr());
+}
+
+TEST(SequenceModule, MemoryPlan) {
+    auto linear1 = make_module<LinearModule>(size(4, 6));
+    auto tanh1 = make_module<TanhModule>(6);
+    auto linear2 = make_module<LinearModule>(size(6, 6));
+    auto tanh2 = make_module<TanhModule>(6);
+    auto linear3 = make_module<LinearModule>(size(6, 3));
+    auto sigmoid = make_module<SigmoidModule>(3);
+    SequenceModule seq({linear1, tanh1, linear2, tanh2, linear3, sigmoid});
+    
+    matrix_t input(4, 5), grad_output(3, 5);
+    input.randu();
+    grad_output.randu();
+    
+    seq.clear();
+    matrix_t output = seq.forward(input);
+    matrix_t grad_input = seq.backward(input, grad_output);
+    matrix_t grad_weight = *linear1->get_grad_params().weight;
+    
+    auto plan = seq.plan(5);
+    ASSERT_LT(plan.planned_bytes, plan.naive_bytes);
+    
+    // nothing reads the output of a linear layer once the activation
+    // after it has run
+    ASSERT_EQ(linear1->get_output()->memptr(), linear2->get_output()->memptr());
+    ASSERT_EQ(linear1->get_output()->memptr(), linear3->get_output()->memptr());
+    
+    seq.clear();
+    ASSERT_TRUE(is_close(seq.forward(input), output));
+    ASSERT_EQ(seq.get_output()->memptr(), sigmoid->get_output()->memptr());
+    ASSERT_TRUE(is_close(seq.backward(input, grad_output), grad_input));
+    ASSERT_TRUE(is_close(*linear1->get_grad_params().weight, grad_weight));
+    
+    // in place activations don't need buffers of their own
+    seq.enable_inplace();
+    ASSERT_LT(seq.get_plan().planned_bytes, plan.planned_bytes);
+    
+    seq.clear();
+    ASSERT_TRUE(is_close(seq.forward(input), output));
+    ASSERT_TRUE(is_close(seq.backward(input, grad_output), grad_input));
+    ASSERT_TRUE(is_close(*linear1->get_grad_params().weight, grad_weight));
+    
+    // a new batch size is planned for on the fly
+    seq.forward(input.cols(0, 1));
+    ASSERT_EQ(seq.get_plan().batch_size, 2u);
+    ASSERT_TRUE(is_close(*seq.get_output(), output.cols(0, 1)));
+}
+
 TEST(LinearParams, Initialize) {
     LinearParams params({3, 5});
 }
@@ -251,6 +425,1029 @@ TEST(LinearModule, SharedWeightsGradCheck) {
     test_gradient2(seq);
 }
 
+TEST(parameter_arena, Contiguous) {
+    auto linear1 = make_module<LinearModule>(size(4, 3));
+    auto linear2 = make_module<LinearModule>(size(3, 2));
+    SequenceModule seq({linear1, linear2});
+    
+    matrix_t weight = *linear1->get_params().weight;
+    parameter_arena params(seq);
+    
+    // values are kept, but now live inside the arena
+    ASSERT_EQ(params.size(), 4*3 + 3 + 3*2 + 2);
+    ASSERT_TRUE(is_close(*linear1->get_params().weight, weight));
+    ASSERT_EQ(linear1->get_params().weight->memptr(), params.data());
+    ASSERT_EQ(linear2->get_params().bias->memptr() + 2, params.end());
+}
+
+TEST(parameter_arena, SharedGradients) {
+    auto encoder = make_module<LinearModule>(size(3, 5));
+    auto decoder =
+        std::make_shared<TransposedLinearModule>(share(encoder->get_params().weight),
+                                                 share(encoder->get_grad_params().weight));
+    SequenceModule seq({encoder, decoder});
+    
+    // the tied weight is only stored once
+    parameter_arena grads(seq, parameter_arena::gradients);
+    ASSERT_EQ(grads.size(), 3*5 + 5 + 3);
+    
+    vector_t input = {0.1, 0.2, 0.3};
+    seq.forward(input);
+    seq.backward(input, input);
+    ASSERT_GT(grads.norm(), 0);
+    
+    grads.clear();
+    ASSERT_EQ(grads.norm(), 0);
+    ASSERT_EQ(accu(abs(*decoder->get_grad_params().weight)), 0);
+}
+
+TEST(mapped_model, SaveLoad) {
+    auto build = []() {
+        auto encoder = make_module<LinearModule>(size(6, 4));
+        auto decoder =
+            std::make_shared<TransposedLinearModule>(share(encoder->get_params().weight),
+                                                     share(encoder->get_grad_params().weight));
+        return make_sequence({
+            {"encoder", encoder},
+            {"activation", make_module<TanhModule>(4)},
+            {"decoder", decoder}
+        });
+    };
+    
+    auto saved = build();
+    const std::string path = std::string(P_tmpdir) + "/gnol_test_model";
+    save_model(*saved, path);
+    
+    auto loaded = build();
+    auto model = load_model(*loaded, path);
+    
+    // the shared weight is stored once, and stays shared
+    ASSERT_EQ(model->get_entries().size(), 3u);
+    ASSERT_EQ(model->get_entries().count("encoder.0"), 1u);
+    
+    auto encoder = std::dynamic_pointer_cast<LinearModule>((*loaded)["encoder"]);
+    auto decoder = std::dynamic_pointer_cast<TransposedLinearModule>((*loaded)["decoder"]);
+    const real_t *weight = encoder->get_params().weight->memptr();
+    ASSERT_EQ(decoder->get_params().weight->memptr(), weight);
+    
+    // values are used straight from the mapping, starting on a page
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(weight) % sysconf(_SC_PAGESIZE), 0u);
+    
+    vector_t input(6);
+    input.randu();
+    ASSERT_TRUE(is_close(loaded->forward(input), saved->forward(input), 10e-10));
+    
+    // a differently built module doesn't fit
+    auto other = make_sequence({{"encoder", make_module<LinearModule>(size(6, 5))}});
+    ASSERT_THROW(model->bind(*other), std::invalid_argument);
+    
+    std::remove(path.c_str());
+}
+
+TEST(mapped_model, NoParameters) {
+    auto build = []() {
+        return make_sequence({
+            {"first", make_module<SigmoidModule>(4)},
+            {"second", make_module<TanhModule>(4)}
+        });
+    };
+    
+    auto saved = build();
+    const std::string path = std::string(P_tmpdir) + "/gnol_test_empty_model";
+    save_model(*saved, path);
+    
+    auto loaded = build();
+    auto model = load_model(*loaded, path);
+    ASSERT_EQ(model->get_entries().size(), 0u);
+    
+    vector_t input(4);
+    input.randu();
+    ASSERT_TRUE(is_close(loaded->forward(input), saved->forward(input), 10e-10));
+    
+    std::remove(path.c_str());
+}
+
+TEST(mapped_model, SharedReadOnly) {
+    auto build = []() {
+        return make_sequence({
+            {"hidden", make_module<LinearModule>(size(5, 3))},
+            {"activation", make_module<SigmoidModule>(3)}
+        });
+    };
+    
+    auto saved = build();
+    const std::string path = std::string(P_tmpdir) + "/gnol_test_shared_model";
+    save_model(*saved, path);
+    
+    // publishing again replaces the object
+    publish_model(path, "/gnol_test_model");
+    publish_model(path, "/gnol_test_model");
+    
+    // two workers map the same pages
+    auto worker1 = build(), worker2 = build();
+    mapped_model model1("/gnol_test_model", mapped_model::read_only, mapped_model::shared_memory);
+    auto model2 = load_model(*worker2, path, mapped_model::read_only);
+    model1.bind(*worker1);
+    ASSERT_TRUE(model1.is_read_only());
+    
+    matrix_t input(5, 4);
+    input.randu();
+    matrix_t expected = saved->forward(input);
+    ASSERT_TRUE(is_close(worker1->forward(input), expected, 10e-10));
+    ASSERT_TRUE(is_close(worker2->forward(input), expected, 10e-10));
+    
+    unpublish_model("/gnol_test_model");
+    std::remove(path.c_str());
+    
+    // an existing mapping outlives the name
+    ASSERT_TRUE(is_close(worker1->forward(input), expected, 10e-10));
+}
+
+TEST(DatasetLoader, Epochs) {
+    const std::string path = std::string(P_tmpdir) + "/gnol_test_dataset";
+    
+    // the first row of each input is the index of the sample
+    const std::size_t samples = 10;
+    matrix_t inputs(3, samples), targets(2, samples);
+    inputs.randu();
+    targets.randu();
+    for (std::size_t i = 0; i < samples; i++)
+        inputs(0, i) = i;
+    
+    {
+        dataset_writer writer(path, 3, 2);
+        writer.append(inputs.cols(0, 5), targets.cols(0, 5));
+        writer.append(inputs.cols(6, 9), targets.cols(6, 9));
+    }
+    
+    auto data = std::make_shared<dataset>(path);
+    ASSERT_EQ(data->size(), samples);
+    
+    // in order, the last batch being smaller
+    {
+        DatasetLoader loader(data, 4, false);
+        for (std::size_t epoch = 0; epoch < 2; epoch++) {
+            std::size_t first = 0;
+            while (auto batch = loader.next()) {
+                ASSERT_EQ(batch->epoch, epoch);
+                ASSERT_TRUE(is_close(batch->input, inputs.cols(first, first + batch->input.n_cols - 1), 10e-10));
+                ASSERT_TRUE(is_close(batch->target, targets.cols(first, first + batch->input.n_cols - 1), 10e-10));
+                first += batch->input.n_cols;
+            }
+            ASSERT_EQ(first, samples);
+        }
+    }
+    
+    // shuffled, every sample still shows up once per epoch
+    DatasetLoader loader(data, 3, true, 3);
+    for (std::size_t epoch = 0; epoch < 3; epoch++) {
+        std::vector<bool> seen(samples, false);
+        while (auto batch = loader.next()) {
+            for (std::size_t j = 0; j < batch->input.n_cols; j++) {
+                const std::size_t i = std::size_t(batch->input(0, j));
+                ASSERT_FALSE(seen[i]);
+                seen[i] = true;
+                ASSERT_TRUE(is_close(batch->target.col(j), targets.col(i), 10e-10));
+            }
+        }
+        ASSERT_EQ(std::size_t(std::count(seen.begin(), seen.end(), true)), samples);
+    }
+    
+    std::remove(path.c_str());
+}
+
+TEST(DatasetLoader, BlockShuffle) {
+    const std::string path = std::string(P_tmpdir) + "/gnol_test_blocks";
+    
+    // the first row of each input is the index of the sample
+    const std::size_t samples = 103;
+    matrix_t inputs(2, samples), targets(1, samples);
+    inputs.randu();
+    targets.randu();
+    for (std::size_t i = 0; i < samples; i++)
+        inputs(0, i) = i;
+    
+    {
+        dataset_writer writer(path, 2, 1);
+        writer.append(inputs, targets);
+    }
+    
+    auto data = std::make_shared<dataset>(path);
+    
+    // 11 blocks (the last one short), 3 shuffled together
+    DatasetLoader loader(data, 8, block_shuffle(10, 3), 2, 7);
+    for (std::size_t epoch = 0; epoch < 3; epoch++) {
+        std::vector<bool> seen(samples, false);
+        std::size_t batches = 0;
+        
+        while (auto batch = loader.next()) {
+            ASSERT_EQ(batch->epoch, epoch);
+            
+            // only the last batch can be smaller
+            if (++batches < (samples + 7)/8)
+                ASSERT_EQ(batch->input.n_cols, 8u);
+            
+            for (std::size_t j = 0; j < batch->input.n_cols; j++) {
+                const std::size_t i = std::size_t(batch->input(0, j));
+                ASSERT_FALSE(seen[i]);
+                seen[i] = true;
+                ASSERT_TRUE(is_close(batch->target.col(j), targets.col(i), 10e-10));
+            }
+        }
+        
+        ASSERT_EQ(batches, (samples + 7)/8);
+        ASSERT_EQ(std::size_t(std::count(seen.begin(), seen.end(), true)), samples);
+    }
+    
+    std::remove(path.c_str());
+}
+
+TEST(SequenceModule, Freeze) {
+    auto factory = []() -> SequenceModule::ptr_t {
+        return make_sequence({
+            make_module<LinearModule>(size(10, 8)),
+            make_module<SigmoidModule>(8),
+            make_module<LinearModule>(size(8, 6)),
+            make_module<TanhModule>(6),
+            make_module<LinearModule>(size(6, 4)),
+            make_module<SigmoidModule>(4)
+        });
+    };
+    
+    auto model = factory();
+    auto frozen = std::dynamic_pointer_cast<SequenceModule>(factory());
+    tie_parameters(*frozen, *model);
+    frozen->freeze();
+    ASSERT_TRUE(frozen->is_frozen());
+    
+    // no gradients left anywhere
+    parameter_arena grads(*frozen, parameter_arena::gradients);
+    ASSERT_EQ(grads.size(), 0u);
+    ASSERT_EQ((*frozen)[0]->get_grad_input().n_elem, 0u);
+    
+    for (std::size_t batch : {5, 3}) {
+        matrix_t input(10, batch);
+        input.randu();
+        
+        ASSERT_TRUE(is_close(frozen->forward(input), model->forward(input), 10e-10));
+        
+        // the activations run in place and the linear outputs take turns
+        // in two buffers
+        ASSERT_EQ(frozen->get_plan().batch_size, batch);
+        ASSERT_EQ(frozen->get_plan().buffers, 2u);
+        
+        matrix_t grad_output(4, batch);
+        grad_output.randu();
+        ASSERT_THROW(frozen->backward(input, grad_output), std::logic_error);
+    }
+}
+
+TEST(SequenceModule, FreezeSharedOutput) {
+    // the reconstruction error of an autoencoder, whose target is the
+    // output of its input module
+    auto factory = []() -> SequenceModule::ptr_t {
+        variable<matrix_t> weight(size(6, 4)), grad_weight(size(6, 4));
+        weight->randu();
+        
+        auto input = make_module<InputModule>(size(6));
+        return make_sequence({
+            input,
+            make_module<LinearModule>(share(weight), share(grad_weight)),
+            make_module<SigmoidModule>(4),
+            make_module<TransposedLinearModule>(share(weight), share(grad_weight)),
+            make_module<SigmoidModule>(6),
+            std::make_shared<CriterionModule<L2Op, L2Gradient>>(share(input->get_output()))
+        });
+    };
+    
+    auto model = factory();
+    auto frozen = std::dynamic_pointer_cast<SequenceModule>(factory());
+    tie_parameters(*frozen, *model);
+    frozen->freeze();
+    
+    matrix_t input(6, 3);
+    input.randu();
+    
+    const matrix_t expected = model->forward(input);
+    ASSERT_GT(accu(expected), 0);
+    ASSERT_TRUE(is_close(frozen->forward(input), expected, 10e-10));
+}
+
+TEST(fuse_modules, MatchesUnfused) {
+    variable<matrix_t> target(size(6, 4));
+    target->randu();
+    
+    // an autoencoder, with the decoder tied to the encoder
+    auto factory = [&]() {
+        variable<matrix_t> weight(size(6, 5)), grad_weight(size(6, 5));
+        weight->randu();
+        grad_weight->zeros();
+        
+        return make_sequence({
+            make_module<LinearModule>(share(weight), share(grad_weight)),
+            make_module<SigmoidModule>(5),
+            make_module<TransposedLinearModule>(share(weight), share(grad_weight)),
+            make_module<TanhModule>(6),
+            std::make_shared<CriterionModule<L2Op, L2Gradient>>(share(target))
+        });
+    };
+    
+    auto plain = factory(), fused = factory();
+    tie_parameters(*fused, *plain);
+    
+    // linear + sigmoid, then tanh + criterion
+    ASSERT_EQ(fuse_modules(*fused), 2u);
+    ASSERT_EQ(fused->size(), 3u);
+    
+    matrix_t input(6, 4);
+    input.randu();
+    ASSERT_TRUE(is_close(fused->forward(input), plain->forward(input), 10e-10));
+    
+    matrix_t grad_output(1, 1);
+    grad_output.ones();
+    plain->clear();
+    fused->clear();
+    ASSERT_TRUE(is_close(fused->backward(input, grad_output), plain->backward(input, grad_output), 10e-10));
+    
+    parameter_arena expected(*plain, parameter_arena::gradients);
+    parameter_arena grads(*fused, parameter_arena::gradients);
+    ASSERT_EQ(grads.size(), expected.size());
+    for (std::size_t i = 0; i < grads.size(); i++)
+        ASSERT_NEAR(grads.data()[i], expected.data()[i], 10e-10);
+    
+    // the target only has 4 columns
+    matrix_t other(6, 5);
+    other.randu();
+    ASSERT_THROW(fused->forward(other), std::invalid_argument);
+}
+
+TEST(StaticSequence, MatchesSequence) {
+    typedef StaticSequence<4, StaticLinear<10, 5>, StaticSigmoid<5>, StaticLinear<5, 3>> fixed_t;
+    typedef StaticSequence<0, StaticLinear<10, 5>, StaticSigmoid<5>, StaticLinear<5, 3>> dynamic_t;
+    
+    fixed_t fixed;
+    dynamic_t dynamic;
+    
+    auto first = make_module<LinearModule>(size(10, 5));
+    auto last = make_module<LinearModule>(size(5, 3));
+    auto seq = make_sequence({first, make_module<SigmoidModule>(5), last});
+    
+    // the same parameters everywhere
+    *first->get_params().weight = *fixed.get_layer<0>().weight;
+    *first->get_params().bias = *fixed.get_layer<0>().bias;
+    *last->get_params().weight = *fixed.get_layer<2>().weight;
+    *last->get_params().bias = *fixed.get_layer<2>().bias;
+    *dynamic.get_layer<0>().weight = *fixed.get_layer<0>().weight;
+    *dynamic.get_layer<0>().bias = *fixed.get_layer<0>().bias;
+    *dynamic.get_layer<2>().weight = *fixed.get_layer<2>().weight;
+    *dynamic.get_layer<2>().bias = *fixed.get_layer<2>().bias;
+    
+    matrix_t input(10, 4), grad_output(3, 4);
+    input.randu();
+    grad_output.randu();
+    
+    const matrix_t expected = seq->forward(input);
+    ASSERT_TRUE(is_close(fixed.forward(input), expected, 10e-10));
+    ASSERT_TRUE(is_close(dynamic.forward(input), expected, 10e-10));
+    ASSERT_TRUE(is_close(*fixed.get_output(), expected, 10e-10));
+    
+    seq->clear();
+    fixed.clear();
+    dynamic.clear();
+    
+    const matrix_t grad_input = seq->backward(input, grad_output);
+    ASSERT_TRUE(is_close(fixed.backward(input, grad_output), grad_input, 10e-10));
+    ASSERT_TRUE(is_close(dynamic.backward(input, grad_output), grad_input, 10e-10));
+    
+    auto values = [](parameter_list params) {
+        std::vector<real_t> result;
+        for (auto &range : params)
+            result.insert(result.end(), range.begin(), range.end());
+        return result;
+    };
+    
+    auto grads = values(seq->flatten_deriv_parameters());
+    auto fixed_grads = values(fixed.flatten_deriv_parameters());
+    ASSERT_EQ(fixed_grads.size(), grads.size());
+    for (std::size_t i = 0; i < grads.size(); i++)
+        ASSERT_NEAR(fixed_grads[i], grads[i], 10e-10);
+    
+    // the batch size is part of the type
+    matrix_t other(10, 3);
+    ASSERT_THROW(fixed.forward(other), std::invalid_argument);
+    ASSERT_NO_THROW(dynamic.forward(other));
+    
+    // the parameters can be moved like any others
+    parameter_arena arena(fixed);
+    ASSERT_EQ(arena.size(), 10*5 + 5 + 5*3 + 3u);
+    ASSERT_TRUE(is_close(fixed.forward(input), expected, 10e-10));
+}
+
+TEST(StaticSequence, Contained) {
+    typedef StaticSequence<0, StaticLinear<10, 5>, StaticSigmoid<5>> encoder_t;
+    
+    shared_model model([]() -> shared_model::module_ptr {
+        return make_sequence({
+            std::make_shared<encoder_t>(),
+            make_module<LinearModule>(size(5, 3))
+        });
+    });
+    
+    matrix_t input(10, 4);
+    input.randu();
+    const matrix_t expected = model.get_model().forward(input);
+    
+    // an inference context is tied to the model, then frozen
+    ASSERT_TRUE(is_close(model.forward(input), expected, 10e-10));
+    
+    auto context = model.acquire();
+    ASSERT_TRUE(context->get_module().is_frozen());
+    
+    auto &inner = dynamic_cast<encoder_t &>(*dynamic_cast<SequenceModule &>(context->get_module())[0]);
+    auto &master = dynamic_cast<encoder_t &>(*dynamic_cast<SequenceModule &>(model.get_model())[0]);
+    ASSERT_EQ(inner.get_layer<0>().weight->memptr(), master.get_layer<0>().weight->memptr());
+    ASSERT_EQ(inner.get_layer<0>().grad_weight->n_elem, 0u);
+}
+
+TEST(shared_model, ConcurrentForward) {
+    shared_model model([]() -> shared_model::module_ptr {
+        auto linear = make_module<LinearModule>(size(6, 4));
+        auto sigmoid = make_module<SigmoidModule>(4);
+        return std::make_shared<SequenceModule>(SequenceModule::list_t({linear, sigmoid}));
+    });
+    
+    const std::size_t threads = 4;
+    std::vector<matrix_t> inputs(threads), expected(threads), outputs(threads);
+    for (std::size_t i = 0; i < threads; i++) {
+        inputs[i].randu(6, 5);
+        expected[i] = model.get_model().forward(inputs[i]);
+    }
+    
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            for (int k = 0; k < 50; k++)
+                outputs[i] = model.forward(inputs[i]);
+        });
+    }
+    
+    for (auto &w : workers)
+        w.join();
+    
+    for (std::size_t i = 0; i < threads; i++)
+        ASSERT_TRUE(is_close(outputs[i], expected[i], 10e-10));
+    
+    // contexts are reused, and only hold views of the model's weights
+    ASSERT_LE(model.size(), threads);
+    
+    auto context = model.acquire();
+    auto &linear = dynamic_cast<LinearModule &>(*dynamic_cast<SequenceModule &>(context->get_module())[0]);
+    auto &master = dynamic_cast<LinearModule &>(*dynamic_cast<SequenceModule &>(model.get_model())[0]);
+    ASSERT_EQ(linear.get_params().weight->memptr(), master.get_params().weight->memptr());
+    
+    // only training contexts keep gradients, and each mode has its own pool
+    ASSERT_TRUE(context->get_module().is_frozen());
+    auto trainable = model.acquire(execution_context::training);
+    ASSERT_FALSE(trainable->get_module().is_frozen());
+    
+    matrix_t grad_output = arma::ones<matrix_t>(4, 5);
+    trainable->forward(inputs[0]);
+    ASSERT_NO_THROW(trainable->backward(inputs[0], grad_output));
+    ASSERT_THROW(context->backward(inputs[0], grad_output), std::logic_error);
+}
+
+TEST(BatchingServer, Batches) {
+    shared_model model([]() -> shared_model::module_ptr {
+        auto linear = make_module<LinearModule>(size(6, 4));
+        auto sigmoid = make_module<SigmoidModule>(4);
+        return std::make_shared<SequenceModule>(SequenceModule::list_t({linear, sigmoid}));
+    });
+    
+    const std::size_t threads = 4, requests = 25;
+    matrix_t inputs(6, threads*requests);
+    inputs.randu();
+    matrix_t expected = model.get_model().forward(inputs);
+    
+    std::vector<std::future<vector_t>> results(threads*requests);
+    {
+        BatchingServer server(model, batching_policy(8, std::chrono::milliseconds(20)));
+        
+        std::vector<std::thread> clients;
+        for (std::size_t i = 0; i < threads; i++) {
+            clients.emplace_back([&, i]() {
+                for (std::size_t k = i*requests; k < (i + 1)*requests; k++)
+                    results[k] = server.submit(inputs.col(k));
+            });
+        }
+        
+        for (auto &c : clients)
+            c.join();
+        
+        for (std::size_t k = 0; k < results.size(); k++)
+            ASSERT_TRUE(is_close(results[k].get(), expected.col(k), 10e-10));
+        
+        // requests arriving together share batches
+        ASSERT_EQ(server.get_served(), threads*requests);
+        ASSERT_LT(server.get_batches(), threads*requests);
+        
+        ASSERT_THROW(server.submit(vector_t(5)), std::invalid_argument);
+    }
+}
+
+TEST(BatchingServer, MismatchedRequest) {
+    // the input size has two dimensions, so submit() can't check it
+    shared_model model([]() -> shared_model::module_ptr {
+        return make_sequence({
+            make_module<InputModule>(size(6, 1)),
+            make_module<LinearModule>(size(6, 4))
+        });
+    });
+    
+    matrix_t inputs(6, 2);
+    inputs.randu();
+    matrix_t expected = model.get_model().forward(inputs);
+    
+    // a batch of all three, led by a valid request
+    BatchingServer server(model, batching_policy(3, std::chrono::seconds(10)));
+    auto a = server.submit(inputs.col(0));
+    auto bad = server.submit(vector_t(5));
+    auto b = server.submit(inputs.col(1));
+    
+    ASSERT_THROW(bad.get(), std::invalid_argument);
+    ASSERT_TRUE(is_close(a.get(), expected.col(0), 10e-10));
+    ASSERT_TRUE(is_close(b.get(), expected.col(1), 10e-10));
+}
+
+TEST(DataParallelTrainer, Gradient) {
+    auto factory = []() -> DataParallelTrainer::module_ptr {
+        auto linear = make_module<LinearModule>(size(6, 4));
+        auto tanh = make_module<TanhModule>(4);
+        return std::make_shared<SequenceModule>(SequenceModule::list_t({linear, tanh}));
+    };
+    
+    thread_pool pool(2);
+    DataParallelTrainer trainer(factory, 3, []() { return std::make_shared<L2Loss>(); }, pool);
+    ASSERT_EQ(trainer.size(), 3u);
+    
+    matrix_t input(6, 10), target(4, 10);
+    input.randu();
+    target.randu();
+    real_t loss = trainer.accumulate(input, target);
+    
+    // the same batch through a single copy of the model
+    auto model = factory();
+    tie_parameters(*model, trainer.get_model());
+    parameter_arena grads(*model, parameter_arena::gradients);
+    
+    L2Loss criterion;
+    model->clear();
+    matrix_t &output = model->forward(input);
+    ASSERT_NEAR(criterion.forward(output, target), loss, 10e-10);
+    model->backward(input, criterion.backward(output, target));
+    
+    ASSERT_EQ(grads.size(), trainer.get_gradients().size());
+    for (std::size_t i = 0; i < grads.size(); i++)
+        ASSERT_NEAR(grads.data()[i], trainer.get_gradients().data()[i], 10e-10);
+    
+    // a batch smaller than the number of replicas
+    trainer.accumulate(input.cols(0, 1), target.cols(0, 1));
+    
+    // the replicas follow the model's parameters
+    real_t before = trainer.train(input, target, 0.1);
+    ASSERT_LT(trainer.accumulate(input, target), before);
+}
+
+TEST(HogwildTrainer, Converges) {
+    auto factory = []() -> DataParallelTrainer::module_ptr {
+        auto linear = make_module<LinearModule>(size(6, 4));
+        auto sigmoid = make_module<SigmoidModule>(4);
+        return std::make_shared<SequenceModule>(SequenceModule::list_t({linear, sigmoid}));
+    };
+    
+    thread_pool pool(2);
+    HogwildTrainer trainer(factory, 3, HogwildTrainer::default_criterion, pool);
+    trainer.set_flush_interval(2);
+    
+    matrix_t input(6, 30), target(4, 30);
+    input.randu();
+    target.randu();
+    
+    real_t first = trainer.train(input, target, 0.05);
+    real_t last = first;
+    for (int epoch = 0; epoch < 20; epoch++)
+        last = trainer.train(input, target, 0.05);
+    
+    ASSERT_LT(last, first);
+}
+
+TEST(Optimizer, Updates) {
+    LinearModule linear(size(3, 2));
+    
+    SGDOptimizer sgd(linear, 0.1);
+    vector_t params(sgd.get_parameters().begin(), sgd.get_parameters().size());
+    vector_t grads(sgd.get_gradients().size());
+    grads.randu();
+    
+    std::copy(grads.begin(), grads.end(), sgd.get_gradients().begin());
+    sgd.step();
+    
+    vector_t expected = params - 0.1*grads;
+    ASSERT_TRUE(is_close(vector_t(sgd.get_parameters().begin(), sgd.get_parameters().size()), expected, 10e-10));
+    
+    // the gradients are cleared as part of the update
+    ASSERT_EQ(sgd.get_gradients().norm(), 0);
+    
+    // an arena the module is already bound to can be shared
+    AdamOptimizer adam(sgd.get_parameters(), sgd.get_gradients(), 0.01);
+    vector_t m(grads.n_elem), v(grads.n_elem);
+    m.zeros();
+    v.zeros();
+    
+    for (int t = 1; t <= 3; t++) {
+        std::copy(grads.begin(), grads.end(), adam.get_gradients().begin());
+        adam.step();
+        
+        m = 0.9*m + 0.1*grads;
+        v = 0.999*v + 0.001*square(grads);
+        vector_t m_hat = m/(1 - std::pow(0.9, t));
+        vector_t v_hat = v/(1 - std::pow(0.999, t));
+        expected -= 0.01*m_hat/(sqrt(v_hat) + 1e-8/std::sqrt(1 - std::pow(0.999, t)));
+    }
+    
+    ASSERT_TRUE(is_close(vector_t(adam.get_parameters().begin(), adam.get_parameters().size()), expected, 10e-8));
+}
+
+TEST(Optimizer, Converges) {
+    auto linear = make_module<LinearModule>(size(4, 3));
+    auto sigmoid = make_module<SigmoidModule>(3);
+    SequenceModule seq({linear, sigmoid});
+    
+    matrix_t input(4, 8), target(3, 8);
+    input.randu();
+    target.randu();
+    
+    L2Loss loss;
+    MomentumOptimizer momentum(seq, 0.1);
+    AdagradOptimizer adagrad(momentum.get_parameters(), momentum.get_gradients(), 0.1);
+    
+    for (Optimizer *optimizer : {static_cast<Optimizer *>(&momentum), static_cast<Optimizer *>(&adagrad)}) {
+        real_t first = 0, last = 0;
+        
+        for (int i = 0; i < 50; i++) {
+            seq.clear();
+            auto &output = seq.forward(input);
+            last = loss.forward(output, target);
+            seq.backward(input, loss.backward(output, target));
+            optimizer->step();
+            
+            if (i == 0)
+                first = last;
+        }
+        
+        ASSERT_LT(last, first);
+    }
+}
+
+TEST(TreeBatcher, MatchesNodeByNode) {
+    const std::size_t n = 3;
+    auto factory = [n]() -> TreeBatcher::module_ptr {
+        auto linear = make_module<LinearModule>(size(2*n, n));
+        auto tanh = make_module<TanhModule>(n);
+        return std::make_shared<SequenceModule>(SequenceModule::list_t({linear, tanh}));
+    };
+    
+    TreeBatcher batcher({factory});
+    
+    // ((a b) (c d)) and (e f)
+    tree_batch trees;
+    auto ab = trees.add_node(trees.add_leaf(0), trees.add_leaf(1));
+    auto cd = trees.add_node(trees.add_leaf(2), trees.add_leaf(3));
+    auto root1 = trees.add_node(ab, cd);
+    auto root2 = trees.add_node(trees.add_leaf(4), trees.add_leaf(5));
+    
+    matrix_t leaves(n, 6);
+    leaves.randu();
+    
+    batcher.clear();
+    matrix_t values = batcher.forward(trees, leaves);
+    
+    // (a b), (c d) and (e f) run together
+    ASSERT_EQ(batcher.num_levels(), 2u);
+    
+    auto single = factory();
+    tie_parameters(*single, batcher.get_composer());
+    for (std::size_t i = 0; i < trees.size(); i++) {
+        if (trees[i].is_leaf())
+            continue;
+        
+        vector_t children = join_cols(values.col(trees[i].left), values.col(trees[i].right));
+        ASSERT_TRUE(is_close(single->forward(children), values.col(i), 10e-10));
+    }
+    
+    // loss is the sum of both roots
+    matrix_t grad_nodes(n, trees.size());
+    grad_nodes.zeros();
+    grad_nodes.col(root1).ones();
+    grad_nodes.col(root2).ones();
+    matrix_t grad_leaves = batcher.backward(grad_nodes);
+    
+    auto loss = [&]() {
+        const matrix_t &result = batcher.forward(trees, leaves);
+        return accu(result.col(root1)) + accu(result.col(root2));
+    };
+    
+    const real_t eps = 10e-6;
+    for (std::size_t i = 0; i < leaves.n_elem; i++) {
+        real_t old_value = leaves[i];
+        leaves[i] = old_value + eps;
+        real_t pvalue = loss();
+        leaves[i] = old_value - eps;
+        real_t nvalue = loss();
+        leaves[i] = old_value;
+        
+        ASSERT_NEAR((pvalue - nvalue)/(2*eps), grad_leaves[i], 10e-6);
+    }
+    
+    // every group accumulated into the same gradients
+    auto params = batcher.get_composer().flatten_parameters();
+    auto grads = batcher.get_composer().flatten_deriv_parameters();
+    auto grad = grads.begin();
+    for (auto &param : params) {
+        for (std::size_t i = 0; i < param.size(); i++) {
+            real_t old_value = param[i];
+            param[i] = old_value + eps;
+            real_t pvalue = loss();
+            param[i] = old_value - eps;
+            real_t nvalue = loss();
+            param[i] = old_value;
+            
+            ASSERT_NEAR((pvalue - nvalue)/(2*eps), (*grad)[i], 10e-6);
+        }
+        ++grad;
+    }
+    
+    // an optimizer moves every instance along with the first
+    SGDOptimizer sgd(batcher.make_arena(), batcher.make_arena(parameter_arena::gradients), 0.1);
+    ASSERT_EQ(sgd.get_parameters().size(), n*2*n + n);
+    sgd.set_pool(nullptr);
+    sgd.step();
+    
+    values = batcher.forward(trees, leaves);
+    tie_parameters(*single, batcher.get_composer());
+    for (std::size_t i = 0; i < trees.size(); i++) {
+        if (trees[i].is_leaf())
+            continue;
+        
+        vector_t children = join_cols(values.col(trees[i].left), values.col(trees[i].right));
+        ASSERT_TRUE(is_close(single->forward(children), values.col(i), 10e-10));
+    }
+}
+
+TEST(GreedyMerger, MatchesNaiveMerge) {
+    const std::size_t n = 4;
+    const std::size_t words = 9;
+    
+    auto encoder = make_module<LinearModule>(size(2*n, n));
+    auto decoder = make_module<LinearModule>(size(n, 2*n));
+    
+    matrix_t sentence(n, words);
+    sentence.randu();
+    
+    tree_batch trees;
+    GreedyMerger merger(encoder, decoder);
+    auto root = merger.build(sentence, trees);
+    
+    ASSERT_EQ(trees.size(), 2*words - 1);
+    ASSERT_EQ(root, trees.size() - 1);
+    ASSERT_LE(merger.num_scored(), 3*(words - 1));
+    
+    // rescore every adjacent pair after every merge
+    std::vector<vector_t> values;
+    std::vector<std::size_t> ids;
+    for (std::size_t i = 0; i < words; i++) {
+        values.push_back(sentence.col(i));
+        ids.push_back(i);
+    }
+    
+    std::size_t next_id = words;
+    while (values.size() > 1) {
+        std::size_t best = 0;
+        real_t best_score = std::numeric_limits<real_t>::max();
+        vector_t best_parent;
+        
+        for (std::size_t i = 0; i + 1 < values.size(); i++) {
+            vector_t children = join_cols(values[i], values[i + 1]);
+            vector_t parent = encoder->forward(children);
+            real_t score = 0.5*accu(square(decoder->forward(parent) - children));
+            
+            if (score < best_score) {
+                best = i;
+                best_score = score;
+                best_parent = parent;
+            }
+        }
+        
+        const auto &node = trees[next_id];
+        ASSERT_EQ(node.left, ids[best]);
+        ASSERT_EQ(node.right, ids[best + 1]);
+        
+        values[best] = best_parent;
+        ids[best] = next_id++;
+        values.erase(values.begin() + best + 1);
+        ids.erase(ids.begin() + best + 1);
+    }
+}
+
+TEST(RecurrentModule, BackpropThroughTime) {
+    const std::size_t input_size = 3, hidden = 4, batch = 2;
+    auto factory = [input_size, hidden]() -> RecurrentModule::module_ptr {
+        return make_sequence({
+            make_module<LinearModule>(size(input_size + hidden, hidden)),
+            make_module<TanhModule>(hidden)
+        });
+    };
+    
+    RecurrentModule rnn(factory, 6, batch);
+    
+    // a longer sequence first, so the shorter one reuses its buffers
+    matrix_t longer(input_size, 6*batch);
+    longer.randu();
+    rnn.clear();
+    rnn.forward(longer);
+    
+    const std::size_t T = 4;
+    matrix_t sequence(input_size, T*batch);
+    sequence.randu();
+    
+    rnn.clear();
+    matrix_t states = rnn.forward(sequence);
+    ASSERT_EQ(states.n_rows, hidden);
+    ASSERT_EQ(states.n_cols, T*batch);
+    
+    // unroll by hand with a single copy of the step
+    auto single = factory();
+    tie_parameters(*single, rnn.get_step());
+    matrix_t state(hidden, batch);
+    state.zeros();
+    for (std::size_t t = 0; t < T; t++) {
+        matrix_t x = join_cols(sequence.cols(t*batch, t*batch + batch - 1), state);
+        state = single->forward(x);
+        ASSERT_TRUE(is_close(states.cols(t*batch, t*batch + batch - 1), state, 10e-10));
+    }
+    
+    matrix_t weights(hidden, T*batch);
+    weights.randu();
+    matrix_t grad_sequence = rnn.backward(sequence, weights);
+    
+    auto loss = [&]() {
+        return accu(rnn.forward(sequence) % weights);
+    };
+    
+    const real_t eps = 10e-6;
+    for (std::size_t i = 0; i < sequence.n_elem; i++) {
+        real_t old_value = sequence[i];
+        sequence[i] = old_value + eps;
+        real_t pvalue = loss();
+        sequence[i] = old_value - eps;
+        real_t nvalue = loss();
+        sequence[i] = old_value;
+        
+        ASSERT_NEAR((pvalue - nvalue)/(2*eps), grad_sequence[i], 10e-6);
+    }
+    
+    // every timestep accumulated into the gradients of the step
+    auto params = rnn.flatten_parameters();
+    auto grads = rnn.flatten_deriv_parameters();
+    auto grad = grads.begin();
+    for (auto &param : params) {
+        for (std::size_t i = 0; i < param.size(); i++) {
+            real_t old_value = param[i];
+            param[i] = old_value + eps;
+            real_t pvalue = loss();
+            param[i] = old_value - eps;
+            real_t nvalue = loss();
+            param[i] = old_value;
+            
+            ASSERT_NEAR((pvalue - nvalue)/(2*eps), (*grad)[i], 10e-6);
+        }
+        ++grad;
+    }
+}
+
+TEST(RecurrentModule, CarryState) {
+    const std::size_t input_size = 3, hidden = 4, batch = 2;
+    RecurrentModule rnn([input_size, hidden]() {
+        return make_module<GRUModule>(input_size, hidden);
+    }, 6, batch);
+    
+    matrix_t sequence(input_size, 6*batch);
+    sequence.randu();
+    matrix_t whole = rnn.forward(sequence);
+    
+    // two chunks of three timesteps give the same states
+    rnn.forward(sequence.cols(0, 3*batch - 1));
+    rnn.carry_state();
+    matrix_t second = rnn.forward(sequence.cols(3*batch, 6*batch - 1));
+    ASSERT_TRUE(is_close(second, whole.cols(3*batch, 6*batch - 1), 10e-10));
+    
+    rnn.reset_state();
+    ASSERT_TRUE(is_close(rnn.forward(sequence), whole, 10e-10));
+}
+
+TEST(RecurrentStreams, MatchesUnrolled) {
+    const std::size_t input_size = 3, hidden = 4, streams = 3, T = 5;
+    auto factory = [input_size, hidden]() -> RecurrentModule::module_ptr {
+        return make_module<LSTMModule>(input_size, hidden);
+    };
+    
+    RecurrentModule rnn(factory, T, streams);
+    matrix_t sequence(input_size, T*streams);
+    sequence.randu();
+    matrix_t expected = rnn.forward(sequence);
+    
+    auto step = factory();
+    tie_parameters(*step, rnn.get_step());
+    RecurrentStreams online(step);
+    
+    // a stream that is closed again leaves a free slot behind
+    online.close(online.open());
+    std::vector<RecurrentStreams::stream_t> ids;
+    for (std::size_t i = 0; i < streams; i++)
+        ids.push_back(online.open());
+    ASSERT_EQ(online.size(), streams);
+    
+    // one token at a time, only the last stream at first
+    vector_t state = online.get_state(ids[2]);
+    online.step({ids[2]}, sequence.col(streams - 1));
+    online.set_state(ids[2], state);
+    
+    for (std::size_t t = 0; t < 2; t++) {
+        matrix_t states = online.step(ids, sequence.cols(t*streams, t*streams + streams - 1));
+        ASSERT_TRUE(is_close(states, expected.cols(t*streams, t*streams + streams - 1), 10e-10));
+    }
+    
+    // then the rest as a chunk
+    matrix_t rest = online.advance(ids, sequence.cols(2*streams, T*streams - 1));
+    ASSERT_TRUE(is_close(rest, expected.cols(2*streams, T*streams - 1), 10e-10));
+    ASSERT_TRUE(is_close(online.get_state(ids[1]), expected.col(T*streams - 2), 10e-10));
+}
+
+TEST(LSTMModule, Forward) {
+    const std::size_t input_size = 3, hidden = 4;
+    LSTMModule lstm(input_size, hidden);
+    
+    matrix_t input(input_size + 2*hidden, 5);
+    input.randu();
+    matrix_t output = lstm.forward(input);
+    
+    const matrix_t &weight = *lstm.get_params().weight;
+    matrix_t gates = weight*input.head_rows(input_size + hidden);
+    gates.each_col() += *lstm.get_params().bias;
+    
+    matrix_t i = 1/(1 + exp(-gates.rows(0, hidden - 1)));
+    matrix_t f = 1/(1 + exp(-gates.rows(hidden, 2*hidden - 1)));
+    matrix_t o = 1/(1 + exp(-gates.rows(2*hidden, 3*hidden - 1)));
+    matrix_t g = tanh(gates.rows(3*hidden, 4*hidden - 1));
+    
+    matrix_t c = f % input.tail_rows(hidden) + i % g;
+    matrix_t h = o % tanh(c);
+    
+    ASSERT_TRUE(is_close(output.head_rows(hidden), h, 10e-10));
+    ASSERT_TRUE(is_close(output.tail_rows(hidden), c, 10e-10));
+}
+
+TEST(LSTMModule, GradCheck) {
+    LSTMModule lstm(3, 4);
+    test_gradient2(lstm);
+}
+
+TEST(GRUModule, Forward) {
+    const std::size_t input_size = 3, hidden = 4;
+    GRUModule gru(input_size, hidden);
+    
+    matrix_t input(input_size + hidden, 5);
+    input.randu();
+    matrix_t output = gru.forward(input);
+    
+    const matrix_t &weight = *gru.get_params().weight;
+    matrix_t x = input.head_rows(input_size), h_prev = input.tail_rows(hidden);
+    matrix_t gates = weight.cols(0, input_size - 1)*x;
+    gates.each_col() += *gru.get_params().bias;
+    matrix_t hidden_gates = weight.cols(input_size, input_size + hidden - 1)*h_prev;
+    
+    matrix_t r = 1/(1 + exp(-(gates.rows(0, hidden - 1) + hidden_gates.rows(0, hidden - 1))));
+    matrix_t z = 1/(1 + exp(-(gates.rows(hidden, 2*hidden - 1) + hidden_gates.rows(hidden, 2*hidden - 1))));
+    matrix_t n = tanh(gates.rows(2*hidden, 3*hidden - 1) + r % hidden_gates.rows(2*hidden, 3*hidden - 1));
+    matrix_t h = (1 - z) % n + z % h_prev;
+    
+    ASSERT_TRUE(is_close(output, h, 10e-10));
+}
+
+TEST(GRUModule, GradCheck) {
+    GRUModule gru(3, 4);
+    test_gradient2(gru);
+}
+
 TEST(ReshapeModule, Initialize) {
     ReshapeModule<2> reshape(size(2, 2), size(4, 1));
 }
@@ -282,6 +1479,162 @@ TEST(ReshapeModule, GradCheck) {
     test_gradient2(seq);
 }
 
+TEST(Convolve2DModule, Forward) {
+    Convolve2DModule conv(Convolve2DGeometry(size(1, 3, 3), size(1, 2, 2)));
+    conv.get_params().kernel->ones();
+    conv.get_params().bias->zeros();
+    
+    // column-major 3x3 image
+    vector_t input = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    auto output = conv.forward(input);
+    
+    vector_t expected = {12, 16, 24, 28};
+    ASSERT_TRUE(is_close(output, expected));
+}
+
+TEST(Convolve2DModule, StridePadding) {
+    Convolve2DGeometry geometry(size(2, 5, 5), size(3, 3, 3), 2, 1);
+    ASSERT_EQ(geometry.output_rows(), 3);
+    ASSERT_EQ(geometry.output_cols(), 3);
+    
+    Convolve2DModule conv(geometry);
+    matrix_t input(geometry.input_size(), 4);
+    input.randu();
+    
+    auto output = conv.forward(input);
+    ASSERT_EQ(output.n_rows, 3*3*3);
+    ASSERT_EQ(output.n_cols, 4);
+}
+
+TEST(Convolve2DModule, GradCheck) {
+    Convolve2DModule conv(Convolve2DGeometry(size(2, 5, 5), size(3, 3, 3), 2, 1));
+    test_gradient2(conv);
+}
+
+TEST(Convolve2DModule, PaddingPerAxis) {
+    Convolve2DGeometry geometry(size(2, 5, 6), size(3, 3, 5), 1, 1, 2);
+    ASSERT_EQ(geometry.output_rows(), 5);
+    ASSERT_EQ(geometry.output_cols(), 6);
+    
+    Convolve2DModule conv(geometry);
+    test_gradient2(conv);
+    
+    ASSERT_THROW(Convolve2DGeometry(size(2, 5, 6), size(3, 3, 5), 0), std::invalid_argument);
+    ASSERT_THROW(Convolve2DGeometry(size(2, 5, 6), size(3, 3, 7)), std::invalid_argument);
+    ASSERT_NO_THROW(Convolve2DGeometry(size(2, 5, 6), size(3, 3, 7), 1, 0, 1));
+}
+
+TEST(convolve2d, NonSquareKernel) {
+    matrix_t input(6, 7), kernel(3, 5), output;
+    input.randu();
+    kernel.randu();
+    convolve2d(input, kernel, output);
+    
+    ASSERT_EQ(output.n_rows, input.n_rows);
+    ASSERT_EQ(output.n_cols, input.n_cols);
+    
+    const int pr = 1, pc = 2;
+    for (int i = 0; i < int(input.n_rows); i++) {
+        for (int j = 0; j < int(input.n_cols); j++) {
+            real_t expected = 0;
+            for (int a = 0; a < int(kernel.n_rows); a++) {
+                for (int b = 0; b < int(kernel.n_cols); b++) {
+                    const int r = i + a - pr, c = j + b - pc;
+                    if (r >= 0 && r < int(input.n_rows) && c >= 0 && c < int(input.n_cols))
+                        expected += input(r, c)*kernel(kernel.n_rows - 1 - a, kernel.n_cols - 1 - b);
+                }
+            }
+            
+            ASSERT_NEAR(output(i, j), expected, 10e-10);
+        }
+    }
+}
+
+TEST(thread_pool, NestedTasks) {
+    thread_pool pool(3);
+    std::atomic<int> count(0);
+    
+    task_group outer(pool);
+    for (int i = 0; i < 8; i++) {
+        outer.run([&pool, &count]() {
+            task_group inner(pool);
+            for (int j = 0; j < 8; j++)
+                inner.run([&count]() { ++count; });
+            inner.wait();
+        });
+    }
+    outer.wait();
+    
+    ASSERT_EQ(count, 64);
+}
+
+TEST(thread_pool, Exception) {
+    thread_pool pool(2);
+    task_group group(pool);
+    
+    for (int i = 0; i < 16; i++)
+        group.run([i]() { if (i == 7) throw std::runtime_error("task failed"); });
+    
+    ASSERT_THROW(group.wait(), std::runtime_error);
+}
+
+TEST(check_gradient, Directional) {
+    auto linear = make_module<LinearModule>(size(200, 100));
+    auto sigmoid = make_module<SigmoidModule>(100);
+    SequenceModule seq({linear, sigmoid});
+    L2Loss loss;
+    
+    vector_t input(200), target(100);
+    input.randu();
+    target.randu();
+    
+    auto eval_fn = [&seq, &loss, &target](const vector_t &x) -> real_t {
+        seq.clear();
+        auto &result = seq.forward(x);
+        auto error = loss.forward(result, target);
+        seq.backward(x, loss.backward(result, target));
+        return error;
+    };
+    
+    auto directional = check_gradient_directional(eval_fn, seq, input, 10e-5);
+    ASSERT_EQ(directional.size(), 4u);
+    for (real_t val : directional)
+        ASSERT_LT(val, 10e-6);
+    
+    auto sampled = check_gradient_sampled(eval_fn, seq, input, 10e-5, 16);
+    ASSERT_EQ(sampled.size(), 16u);
+    for (real_t val : sampled)
+        ASSERT_LT(val, 10e-6);
+}
+
+TEST(check_gradient, Parallel) {
+    auto factory = []() -> std::shared_ptr<GradientModule> {
+        return make_module<LinearModule>(size(5, 3));
+    };
+    
+    vector_t input(5), target(3);
+    input.randu();
+    target.randu();
+    
+    auto eval_fn = [&target](GradientModule &mod, const vector_t &x) -> real_t {
+        // runs on several threads at once, so each call needs its own loss
+        L2Loss loss;
+        mod.clear();
+        auto &result = mod.forward(x);
+        auto error = loss.forward(result, target);
+        mod.backward(x, loss.backward(result, target));
+        return error;
+    };
+    
+    auto linear = factory();
+    thread_pool pool(3);
+    auto result = check_gradient_parallel(factory, eval_fn, *linear, input, 10e-4, pool);
+    
+    ASSERT_EQ(result.size(), 18u);
+    for (real_t val : result)
+        ASSERT_LT(val, 10e-4);
+}
+
 TEST(ConcatenateModule, Forward) {
     auto linear1 = make_module<LinearModule>(size(10, 5));
     matrix_t eye1 = {
@@ -361,6 +1714,94 @@ TEST(ConcatModule, GradCheck) {
     test_gradient2(concat);
 }
 
+TEST(ConcatModule, BatchForward) {
+    auto linear1 = make_module<LinearModule>(size(10, 5));
+    auto linear2 = make_module<LinearModule>(size(10, 3));
+    ConcatModule concat({linear1, linear2});
+    
+    matrix_t input(10, 4);
+    input.randu();
+    matrix_t output = concat.forward(input);
+    
+    ASSERT_EQ(output.n_rows, 8);
+    ASSERT_EQ(output.n_cols, 4);
+    ASSERT_TRUE(is_close(output.rows(0, 4), linear1->forward(input)));
+    ASSERT_TRUE(is_close(output.rows(5, 7), linear2->forward(input)));
+}
+
+TEST(ConcatModule, ZeroCopy) {
+    auto linear1 = make_module<LinearModule>(size(6, 2));
+    auto linear2 = make_module<LinearModule>(size(6, 3));
+    auto linear3 = make_module<LinearModule>(size(6, 4));
+    auto inner = make_concat({linear1, linear2});
+    ConcatModule outer({inner, linear3});
+    
+    vector_t input(6), grad_output(9);
+    input.randu();
+    grad_output.randu();
+    
+    matrix_t output = outer.forward(input);
+    ASSERT_TRUE(is_close(output.rows(0, 1), linear1->forward(input)));
+    ASSERT_TRUE(is_close(output.rows(5, 8), linear3->forward(input)));
+    
+    // every level writes straight into the outermost output
+    const real_t *memory = outer.get_output()->memptr();
+    ASSERT_EQ(inner->get_output()->memptr(), memory);
+    ASSERT_EQ(linear2->get_output()->memptr(), memory + 2);
+    ASSERT_EQ(linear3->get_output()->memptr(), memory + 5);
+    
+    outer.clear();
+    outer.backward(input, grad_output);
+    ASSERT_TRUE(is_close(*linear2->get_grad_params().bias, grad_output.rows(2, 4)));
+    
+    // a batch falls back to copying
+    matrix_t batch(6, 3);
+    batch.randu();
+    matrix_t batch_output = outer.forward(batch);
+    ASSERT_TRUE(is_close(batch_output.col(1), outer.forward(batch.col(1))));
+}
+
+TEST(ConcatModule, Parallel) {
+    std::list<std::shared_ptr<GradientModule>> branches;
+    for (std::size_t i = 0; i < 4; i++)
+        branches.push_back(make_module<LinearModule>(size(8, 16)));
+    ConcatModule concat(branches);
+    
+    matrix_t input(8, 32), grad_output(64, 32);
+    input.randu();
+    grad_output.randu();
+    
+    concat.set_grain(std::numeric_limits<std::size_t>::max());
+    concat.clear();
+    matrix_t output = concat.forward(input);
+    matrix_t grad_input = concat.backward(input, grad_output);
+    
+    for (auto branch : branches)
+        branch->clear();
+    
+    concat.set_grain(0);
+    concat.clear();
+    ASSERT_TRUE(is_close(concat.forward(input), output));
+    ASSERT_TRUE(is_close(concat.backward(input, grad_output), grad_input));
+}
+
+TEST(branch_scheduler, SharedModuleInBranches) {
+    auto a = make_module<LinearModule>(size(8, 4));
+    auto b = make_module<LinearModule>(size(8, 4));
+    auto sigmoid = make_module<SigmoidModule>(4);
+    
+    ASSERT_TRUE(branch_scheduler({a, b}).is_independent());
+    
+    // a module without parameters, shared below the top of each branch
+    auto left = make_sequence({a, sigmoid});
+    auto right = make_sequence({b, sigmoid});
+    ASSERT_FALSE(branch_scheduler({left, right}).is_independent());
+    
+    // used twice within one branch is fine
+    auto twice = make_sequence({b, sigmoid, sigmoid});
+    ASSERT_TRUE(branch_scheduler({a, twice}).is_independent());
+}
+
 TEST(JoinModule, Forward) {
     auto linear1 = make_module<LinearModule>(size(10, 5));
     linear1->get_params().weight->eye();
@@ -10,29 +10,125 @@
 #define rnn_activation_hpp
 
 #include "module.hpp"
+#include "kernels.hpp"
 
 namespace gnol {
-    class SigmoidModule: public GradientModule {
+    /*!
+     ActivationModule applies an elementwise function, given as an OpT that
+     maps input to output and a GradOpT that computes the gradient from the
+     output alone.
+
+     In place mode writes the activation over the input buffer (and makes
+     the output a view of it), which halves the memory used by the layer.
+     It must only be enabled when nothing else reads the input afterwards;
+     SequenceModule::enable_inplace() decides that for its children.
+     */
+    template <typename OpT, typename GradOpT>
+    class ActivationModule: public GradientModule {
+    protected:
+        OpT op;
+        GradOpT grad;
+        bool inplace;
     public:
-        SigmoidModule(size_t size):
-            GradientModule(size, size) {}
-        
-        SigmoidModule(ssize_t<1> size):
-            GradientModule(size, size) {}
-        
+        ActivationModule(size_t size):
+            GradientModule(size, size),
+            inplace(false) {}
+
         matrix_t &forward(const matrix_t &input) {
-            *output = 1.0 / (1.0 + exp(-input));
+            if (inplace) {
+                real_t *buffer = const_cast<real_t *>(input.memptr());
+                op(buffer, buffer, input.n_elem);
+
+                if (output->memptr() != buffer ||
+                    output->n_rows != input.n_rows ||
+                    output->n_cols != input.n_cols)
+                {
+                    output.rebind(buffer, input.n_rows, input.n_cols, false);
+                }
+            } else {
+                output->set_size(input.n_rows, input.n_cols);
+                op(input.memptr(), output->memptr(), input.n_elem);
+            }
+
             return *output;
         }
-        
+
         matrix_t &backward(const matrix_t &input, const matrix_t &grad_output) {
-            grad_input += grad_output % (1.0 - *output) % *output;
+            match_grad_input(input);
+            grad(output->memptr(), grad_output.memptr(), grad_input.memptr(), grad_input.n_elem);
             return grad_input;
         }
-        
+
+        bool supports_inplace() const { return true; }
+        bool backward_uses_input() const { return false; }
+        bool backward_uses_output() const { return true; }
+
+        void set_inplace(bool enable) {
+            // stop viewing the input's memory
+            if (inplace && !enable)
+                output.detach();
+
+            inplace = enable;
+        }
+
+        bool is_inplace() const { return inplace; }
+
         virtual parameter_list flatten_parameters() { return parameter_list(); }
         virtual parameter_list flatten_deriv_parameters() { return parameter_list(); }
     };
+
+    struct SigmoidOp {
+        void operator ()(const real_t *input, real_t *output, std::size_t n) {
+            kernels::sigmoid(input, output, n);
+        }
+    };
+
+    struct SigmoidGradient {
+        void operator ()(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            kernels::sigmoid_backward(output, grad_output, grad_input, n);
+        }
+    };
+
+    struct TanhOp {
+        void operator ()(const real_t *input, real_t *output, std::size_t n) {
+            kernels::tanh(input, output, n);
+        }
+    };
+
+    struct TanhGradient {
+        void operator ()(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            kernels::tanh_backward(output, grad_output, grad_input, n);
+        }
+    };
+
+    struct ReLUOp {
+        void operator ()(const real_t *input, real_t *output, std::size_t n) {
+            kernels::relu(input, output, n);
+        }
+    };
+
+    struct ReLUGradient {
+        void operator ()(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            kernels::relu_backward(output, grad_output, grad_input, n);
+        }
+    };
+
+    struct SoftplusOp {
+        void operator ()(const real_t *input, real_t *output, std::size_t n) {
+            kernels::softplus(input, output, n);
+        }
+    };
+
+    struct SoftplusGradient {
+        void operator ()(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            kernels::softplus_backward(output, grad_output, grad_input, n);
+        }
+    };
+
+    typedef ActivationModule<SigmoidOp, SigmoidGradient> SigmoidModule;
+    typedef ActivationModule<TanhOp, TanhGradient> TanhModule;
+    typedef ActivationModule<ReLUOp, ReLUGradient> ReLUModule;
+    typedef ActivationModule<SoftplusOp, SoftplusGradient> SoftplusModule;
 }
 
 #endif
@@ -0,0 +1,151 @@
+//
+//  arena.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/2/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+namespace gnol {
+    namespace {
+        /*!
+         Collects each distinct parameter once, along with a way to move
+         it into new storage. Variables that alias a parameter already
+         seen (e.g. those of tied modules) are moved along with it.
+         */
+        struct collect_parameters: public parameter_visitor {
+            struct entry {
+                real_t *memory;
+                std::size_t length;
+                std::function<void (real_t *)> rebind;
+            };
+
+            std::vector<entry> entries;
+            std::map<const real_t *, std::size_t> seen;
+            std::size_t length;
+
+            collect_parameters(): length(0) {}
+
+            template <typename MatrixT>
+            void add(variable<MatrixT> &param) {
+                if (param->n_elem == 0)
+                    return;
+
+                // parameters are members of the module, so they live
+                // at least as long as the binding
+                variable<MatrixT> *var = &param;
+                auto found = seen.find(param->memptr());
+
+                if (found != seen.end()) {
+                    auto &rebind = entries[found->second].rebind;
+                    auto previous = rebind;
+                    rebind = [previous, var](real_t *memory) {
+                        previous(memory);
+                        var->rebind(memory);
+                    };
+                    return;
+                }
+
+                seen[param->memptr()] = entries.size();
+                entries.push_back({param->memptr(), param->n_elem,
+                    [var](real_t *memory) { var->rebind(memory); }});
+                length += param->n_elem;
+            }
+
+            void operator ()(variable<matrix_t> &param) { add(param); }
+            void operator ()(variable<vector_t> &param) { add(param); }
+        };
+    }
+
+    parameter_arena::parameter_arena():
+        length(0) {}
+
+    parameter_arena::parameter_arena(GradientModule &mod, kind_t kind):
+        parameter_arena([&mod, kind](parameter_visitor &visitor) {
+            if (kind == parameters)
+                mod.visit_parameters(visitor);
+            else
+                mod.visit_deriv_parameters(visitor);
+        }) {}
+
+    parameter_arena::parameter_arena(const visit_t &visit):
+        length(0)
+    {
+        collect_parameters collect;
+        visit(collect);
+
+        allocate(collect.length);
+
+        // copy the current values over before pointing the parameter at
+        // its section of the arena
+        real_t *pos = data();
+        for (auto &entry : collect.entries) {
+            std::copy(entry.memory, entry.memory + entry.length, pos);
+            entry.rebind(pos);
+            pos += entry.length;
+        }
+    }
+
+    void parameter_arena::allocate(std::size_t length) {
+        memory = allocate_aligned(length, alignment);
+        this->length = length;
+    }
+
+    parameter_list parameter_arena::flatten() {
+        parameter_list params = {
+            boost::make_iterator_range(begin(), end())
+        };
+
+        return params;
+    }
+
+    void parameter_arena::clear() {
+        std::fill(begin(), end(), 0);
+    }
+
+    void tie_parameters(GradientModule &replica, GradientModule &master, parameter_arena::kind_t kind) {
+        collect_parameters from, to;
+        
+        if (kind == parameter_arena::parameters) {
+            master.visit_parameters(from);
+            replica.visit_parameters(to);
+        } else {
+            master.visit_deriv_parameters(from);
+            replica.visit_deriv_parameters(to);
+        }
+        
+        if (from.entries.size() != to.entries.size())
+            throw std::invalid_argument("tie_parameters: modules have different parameters");
+        
+        for (std::size_t i = 0; i < from.entries.size(); i++) {
+            if (from.entries[i].length != to.entries[i].length)
+                throw std::invalid_argument("tie_parameters: parameter sizes don't match");
+        }
+        
+        // a replica built on variables shared with master (share()) is
+        // tied already, and rebinding a matrix onto itself would free it
+        for (std::size_t i = 0; i < from.entries.size(); i++) {
+            if (to.entries[i].memory != from.entries[i].memory)
+                to.entries[i].rebind(from.entries[i].memory);
+        }
+    }
+
+    real_t parameter_arena::norm() const {
+        const real_t *values = data();
+        real_t total = 0;
+
+        for (std::size_t i = 0; i < length; i++)
+            total += values[i]*values[i];
+
+        return std::sqrt(total);
+    }
+}
@@ -0,0 +1,89 @@
+//
+//  arena.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/2/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef arena_hpp
+#define arena_hpp
+
+#include <functional>
+#include <memory>
+
+#include "module.hpp"
+
+namespace gnol {
+    /*!
+     parameter_arena moves all of the parameters of a module (or all of its
+     gradients) into a single contiguous, aligned buffer. Each parameter
+     becomes a view into the buffer, so operations over every parameter
+     (clearing, optimizer steps, norms, checkpointing) can run as a single
+     pass over memory.
+
+     Parameters shared between modules are only stored once. The arena must
+     outlive the modules bound to it.
+
+     \code
+     auto seq = make_sequence({
+        make_module<LinearModule>(size(10, 5)),
+        make_module<SigmoidModule>(5)
+     });
+
+     parameter_arena params(*seq);
+     parameter_arena grads(*seq, parameter_arena::gradients);
+
+     grads.clear();
+     */
+    class parameter_arena {
+    public:
+        enum kind_t { parameters, gradients };
+        typedef std::function<void (parameter_visitor &)> visit_t;
+
+        // alignment (in bytes) of the start of the buffer
+        static const std::size_t alignment = 64;
+    protected:
+        std::shared_ptr<real_t> memory;
+        std::size_t length;
+    public:
+        parameter_arena();
+        parameter_arena(GradientModule &mod, kind_t kind=parameters);
+
+        // whatever visit hands out, for holders of modules that aren't
+        // modules themselves (e.g. TreeBatcher)
+        explicit parameter_arena(const visit_t &visit);
+
+        real_t *data() { return memory.get(); }
+        const real_t *data() const { return memory.get(); }
+        std::size_t size() const { return length; }
+
+        real_t *begin() { return data(); }
+        real_t *end() { return data() + length; }
+
+        // a single range covering every parameter
+        parameter_list flatten();
+
+        void clear();
+        real_t norm() const;
+    protected:
+        void allocate(std::size_t length);
+    };
+    
+    /*!
+     Points every parameter of replica at the storage of the matching
+     parameter of master, so the two compute with the same values while
+     keeping their own gradients (or, with kind set to gradients, points
+     the gradients of replica at those of master so both accumulate into
+     the same place). Both modules must have been built the same way;
+     std::invalid_argument is thrown if their parameters don't line up.
+     The storage of master must stay where it is (e.g. not be moved into
+     a parameter_arena) for as long as replica is used, unless replica is
+     moved along with it, which an arena does when both are visited as
+     parts of the module it is built on.
+     */
+    void tie_parameters(GradientModule &replica, GradientModule &master,
+                        parameter_arena::kind_t kind=parameter_arena::parameters);
+}
+
+#endif /* arena_hpp */
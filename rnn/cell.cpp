@@ -0,0 +1,147 @@
+//
+//  cell.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/14/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "cell.hpp"
+#include "kernels.hpp"
+
+namespace gnol {
+    namespace {
+        variable<matrix_t> random_weight(std::size_t rows, std::size_t cols) {
+            variable<matrix_t> weight(size(rows, cols));
+            weight->randu();
+            return weight;
+        }
+    }
+
+    LSTMModule::LSTMModule(std::size_t input, std::size_t hidden):
+        GradientModule(input + 2*hidden, 2*hidden),
+        n_input(input),
+        n_hidden(hidden),
+        params(random_weight(4*hidden, input + hidden)),
+        grad_params(variable<matrix_t>(size(4*hidden, input + hidden))) {}
+
+    void LSTMModule::clear() {
+        grad_input.zeros();
+        grad_params.clear();
+    }
+
+    matrix_t &LSTMModule::forward(const matrix_t &input) {
+        const std::size_t batch = input.n_cols;
+        const std::size_t rows = n_input + n_hidden;
+
+        // every gate of every sample in one product
+        stacked = input.head_rows(rows);
+        gates = *params.weight*stacked;
+        gates.each_col() += *params.bias;
+
+        tanh_c.set_size(n_hidden, batch);
+        output->set_size(2*n_hidden, batch);
+
+        for (std::size_t b = 0; b < batch; b++) {
+            real_t *state = output->colptr(b);
+            kernels::lstm_forward(gates.colptr(b), input.colptr(b) + rows,
+                                  state + n_hidden, tanh_c.colptr(b), state, n_hidden);
+        }
+
+        return *output;
+    }
+
+    matrix_t &LSTMModule::backward(const matrix_t &input, const matrix_t &grad_output) {
+        match_grad_input(input);
+
+        const std::size_t batch = input.n_cols;
+        const std::size_t rows = n_input + n_hidden;
+
+        grad_gates.set_size(4*n_hidden, batch);
+
+        for (std::size_t b = 0; b < batch; b++) {
+            const real_t *grad = grad_output.colptr(b);
+            kernels::lstm_backward(gates.colptr(b), input.colptr(b) + rows, tanh_c.colptr(b),
+                                   grad, grad + n_hidden,
+                                   grad_gates.colptr(b), grad_input.colptr(b) + rows, n_hidden);
+        }
+
+        *grad_params.weight += grad_gates*stacked.t();
+        *grad_params.bias += sum(grad_gates, 1);
+
+        grad_stacked = params.weight->t()*grad_gates;
+        grad_input.head_rows(rows) += grad_stacked;
+
+        return grad_input;
+    }
+
+    GRUModule::GRUModule(std::size_t input, std::size_t hidden):
+        GradientModule(input + hidden, hidden),
+        n_input(input),
+        n_hidden(hidden),
+        params(random_weight(3*hidden, input + hidden)),
+        grad_params(variable<matrix_t>(size(3*hidden, input + hidden))) {}
+
+    void GRUModule::clear() {
+        grad_input.zeros();
+        grad_params.clear();
+    }
+
+    matrix_t &GRUModule::forward(const matrix_t &input) {
+        const std::size_t batch = input.n_cols;
+
+        // the columns of weight for the input and for the previous state
+        // are contiguous, so both are used in place
+        matrix_t &weight = *params.weight;
+        const matrix_t input_weight(weight.memptr(), 3*n_hidden, n_input, false, true);
+        const matrix_t hidden_weight(weight.colptr(n_input), 3*n_hidden, n_hidden, false, true);
+
+        inputs = input.head_rows(n_input);
+        states = input.tail_rows(n_hidden);
+
+        gates = input_weight*inputs;
+        gates.each_col() += *params.bias;
+        hidden_gates = hidden_weight*states;
+
+        output->set_size(n_hidden, batch);
+
+        for (std::size_t b = 0; b < batch; b++)
+            kernels::gru_forward(gates.colptr(b), hidden_gates.colptr(b), states.colptr(b),
+                                 output->colptr(b), n_hidden);
+
+        return *output;
+    }
+
+    matrix_t &GRUModule::backward(const matrix_t &input, const matrix_t &grad_output) {
+        match_grad_input(input);
+
+        const std::size_t batch = input.n_cols;
+
+        grad_gates.set_size(3*n_hidden, batch);
+        grad_hidden_gates.set_size(3*n_hidden, batch);
+
+        for (std::size_t b = 0; b < batch; b++)
+            kernels::gru_backward(gates.colptr(b), hidden_gates.colptr(b), states.colptr(b),
+                                  grad_output.colptr(b), grad_gates.colptr(b), grad_hidden_gates.colptr(b),
+                                  grad_input.colptr(b) + n_input, n_hidden);
+
+        matrix_t &weight = *params.weight;
+        const matrix_t input_weight(weight.memptr(), 3*n_hidden, n_input, false, true);
+        const matrix_t hidden_weight(weight.colptr(n_input), 3*n_hidden, n_hidden, false, true);
+
+        matrix_t &grad_weight = *grad_params.weight;
+        matrix_t grad_input_weight(grad_weight.memptr(), 3*n_hidden, n_input, false, true);
+        matrix_t grad_hidden_weight(grad_weight.colptr(n_input), 3*n_hidden, n_hidden, false, true);
+
+        grad_input_weight += grad_gates*inputs.t();
+        grad_hidden_weight += grad_hidden_gates*states.t();
+        *grad_params.bias += sum(grad_gates, 1);
+
+        grad_inputs = input_weight.t()*grad_gates;
+        grad_states = hidden_weight.t()*grad_hidden_gates;
+        grad_input.head_rows(n_input) += grad_inputs;
+        grad_input.tail_rows(n_hidden) += grad_states;
+
+        return grad_input;
+    }
+}
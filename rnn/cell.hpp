@@ -0,0 +1,113 @@
+//
+//  cell.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/14/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef cell_hpp
+#define cell_hpp
+
+#include "module.hpp"
+#include "linear.hpp"
+
+namespace gnol {
+    /*!
+     LSTMModule is a single LSTM step with its gate weights concatenated,
+     so a step over a batch is one matrix product followed by one fused
+     kernel (kernels::lstm_forward) per sample.
+
+     The input is the sequence input stacked on the previous hidden and
+     cell state (input + 2*hidden rows) and the output is the new hidden
+     state stacked on the new cell state (2*hidden rows). That makes the
+     pair of states the "hidden state" of a RecurrentModule, which can
+     unroll the step directly:
+
+     \code
+     RecurrentModule rnn([]() {
+        return make_module<LSTMModule>(input, hidden);
+     }, 500);
+     \endcode
+
+     weight is 4*hidden x (input + hidden), mapping the input and previous
+     hidden state to the input, forget, output and candidate gates (in
+     that order).
+     */
+    class LSTMModule: public GradientModule {
+    protected:
+        std::size_t n_input, n_hidden;
+
+        LinearParams params;
+        LinearGradParams grad_params;
+
+        // gate activations and tanh of the cell state are kept for
+        // backward; the rest is scratch reused between calls
+        matrix_t stacked, gates, tanh_c;
+        matrix_t grad_gates, grad_stacked;
+    public:
+        LSTMModule(std::size_t input, std::size_t hidden);
+
+        std::size_t get_hidden_size() const { return n_hidden; }
+
+        LinearParams &get_params() { return params; }
+        LinearGradParams &get_grad_params() { return grad_params; }
+
+        void clear();
+
+        matrix_t &forward(const matrix_t &input);
+        matrix_t &backward(const matrix_t &input, const matrix_t &grad_output);
+
+        parameter_list flatten_parameters() { return params.flatten(); }
+        parameter_list flatten_deriv_parameters() { return grad_params.flatten(); }
+
+        void visit_parameters(parameter_visitor &visitor) { params.visit(visitor); }
+        void visit_deriv_parameters(parameter_visitor &visitor) { grad_params.visit(visitor); }
+    };
+
+    /*!
+     GRUModule is a single GRU step. The input is the sequence input
+     stacked on the previous hidden state (input + hidden rows) and the
+     output is the new hidden state, so it can be unrolled by
+     RecurrentModule as is.
+
+     weight is 3*hidden x (input + hidden), for the reset, update and
+     candidate gates (in that order). The reset gate is applied to the
+     previous state's contribution to the candidate after the product, so
+     a step is one matrix product for the input and one for the previous
+     state (each covering every gate), followed by one fused kernel
+     (kernels::gru_forward) per sample.
+     */
+    class GRUModule: public GradientModule {
+    protected:
+        std::size_t n_input, n_hidden;
+
+        LinearParams params;
+        LinearGradParams grad_params;
+
+        // gate activations and the previous state's part of the
+        // candidate are kept for backward
+        matrix_t inputs, states, gates, hidden_gates;
+        matrix_t grad_gates, grad_hidden_gates, grad_inputs, grad_states;
+    public:
+        GRUModule(std::size_t input, std::size_t hidden);
+
+        std::size_t get_hidden_size() const { return n_hidden; }
+
+        LinearParams &get_params() { return params; }
+        LinearGradParams &get_grad_params() { return grad_params; }
+
+        void clear();
+
+        matrix_t &forward(const matrix_t &input);
+        matrix_t &backward(const matrix_t &input, const matrix_t &grad_output);
+
+        parameter_list flatten_parameters() { return params.flatten(); }
+        parameter_list flatten_deriv_parameters() { return grad_params.flatten(); }
+
+        void visit_parameters(parameter_visitor &visitor) { params.visit(visitor); }
+        void visit_deriv_parameters(parameter_visitor &visitor) { grad_params.visit(visitor); }
+    };
+}
+
+#endif /* cell_hpp */
@@ -9,8 +9,53 @@
 #include "check_gradient.hpp"
 #include "criterion.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
 //using namespace gnol;
 namespace gnol {
+    namespace {
+        // the location of every parameter, in the order of flatten_parameters()
+        std::vector<real_t *> parameter_values(GradientModule &mod) {
+            std::vector<real_t *> values;
+            
+            for (auto &param : mod.flatten_parameters()) {
+                for (auto pos = param.begin(); pos != param.end(); ++pos)
+                    values.push_back(&*pos);
+            }
+            
+            return values;
+        }
+        
+        // a copy of the gradients, so perturbing the parameters (which
+        // runs backward again) doesn't overwrite them
+        std::vector<real_t> gradient_values(GradientModule &mod) {
+            std::vector<real_t> grad;
+            
+            for (auto &dparam : mod.flatten_deriv_parameters())
+                grad.insert(grad.end(), dparam.begin(), dparam.end());
+            
+            return grad;
+        }
+        
+        // central difference of fn at a single parameter
+        template <typename FnT>
+        real_t difference(FnT fn, real_t *param, real_t eps) {
+            real_t old_value = *param;
+            *param = old_value + eps;
+            real_t pvalue = fn();
+            
+            *param = old_value - eps;
+            real_t nvalue = fn();
+            *param = old_value;
+            
+            return (pvalue - nvalue) / (2*eps);
+        }
+    }
+    
     std::list<real_t> check_gradient(std::function<real_t (const vector_t &)> fn,
                                     GradientModule &mod,
                                     const vector_t &input,
@@ -20,38 +65,148 @@ namespace gnol {
         
         // calculate gradients
         fn(input);
-
-        // flatten out parameters so we can iterate over them below
-        parameter_list params = mod.flatten_parameters();
-        parameter_list dparams = mod.flatten_deriv_parameters();
-        
-        // copy gradients to save the analytical solution
-        // (otherwise we'll affect them with the code below)
-        std::list<real_t> grad;
-        for (auto dparam : dparams) {
-            std::copy(dparam.begin(), dparam.end(), std::inserter(grad, grad.end()));
-        }
+        
+        auto grad = gradient_values(mod);
+        auto params = parameter_values(mod);
+        auto eval = [&fn, &input]() { return fn(input); };
         
         // perturb each parameter and evaluate fn()
-        auto grad_pos = grad.begin();
-        for (auto &param : params) {
-            for (std::size_t i = 0; i < param.size(); i++) {
-                real_t old_value = param[i];
-                param[i] += eps;
-                real_t pvalue = fn(input);
-                
-                param[i] = old_value-eps;
-                real_t nvalue = fn(input);
-                param[i] = old_value;
-                
-                real_t numerical_diff = (pvalue - nvalue) / (2*eps);
-                real_t analytical_diff = *grad_pos++;
-                real_t diff = fabs(numerical_diff - analytical_diff);
-
-                result.push_back(diff);
+        for (std::size_t i = 0; i < params.size(); i++)
+            result.push_back(std::fabs(difference(eval, params[i], eps) - grad[i]));
+        
+        return result;
+    }
+    
+    std::list<real_t> check_gradient_directional(std::function<real_t (const vector_t &)> fn,
+                                                 GradientModule &mod,
+                                                 const vector_t &input,
+                                                 real_t eps,
+                                                 std::size_t directions,
+                                                 unsigned seed)
+    {
+        std::list<real_t> result;
+        
+        fn(input);
+        
+        auto grad = gradient_values(mod);
+        auto params = parameter_values(mod);
+        
+        std::vector<real_t> original(params.size());
+        for (std::size_t i = 0; i < params.size(); i++)
+            original[i] = *params[i];
+        
+        std::mt19937 rng(seed);
+        std::normal_distribution<real_t> normal;
+        std::vector<real_t> direction(params.size());
+        
+        for (std::size_t k = 0; k < directions; k++) {
+            real_t norm = 0;
+            for (auto &d : direction) {
+                d = normal(rng);
+                norm += d*d;
             }
+            norm = std::sqrt(norm);
+            
+            real_t analytical_diff = 0;
+            for (std::size_t i = 0; i < params.size(); i++) {
+                direction[i] /= norm;
+                analytical_diff += grad[i]*direction[i];
+            }
+            
+            // parameters shared between modules show up more than once,
+            // which moves them along the sum of their components, and the
+            // projection above counts their (total) gradient once for
+            // each, so the two still agree
+            for (std::size_t i = 0; i < params.size(); i++)
+                *params[i] += eps*direction[i];
+            real_t pvalue = fn(input);
+            
+            for (std::size_t i = 0; i < params.size(); i++)
+                *params[i] -= 2*eps*direction[i];
+            real_t nvalue = fn(input);
+            
+            for (std::size_t i = 0; i < params.size(); i++)
+                *params[i] = original[i];
+            
+            real_t numerical_diff = (pvalue - nvalue) / (2*eps);
+            result.push_back(std::fabs(numerical_diff - analytical_diff));
+        }
+        
+        return result;
+    }
+    
+    std::list<real_t> check_gradient_sampled(std::function<real_t (const vector_t &)> fn,
+                                             GradientModule &mod,
+                                             const vector_t &input,
+                                             real_t eps,
+                                             std::size_t samples,
+                                             unsigned seed)
+    {
+        std::list<real_t> result;
+        
+        fn(input);
+        
+        auto grad = gradient_values(mod);
+        auto params = parameter_values(mod);
+        auto eval = [&fn, &input]() { return fn(input); };
+        
+        if (params.empty())
+            return result;
+        
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<std::size_t> pick(0, params.size() - 1);
+        
+        for (std::size_t k = 0; k < samples; k++) {
+            std::size_t i = pick(rng);
+            result.push_back(std::fabs(difference(eval, params[i], eps) - grad[i]));
+        }
+        
+        return result;
+    }
+    
+    std::list<real_t> check_gradient_parallel(std::function<std::shared_ptr<GradientModule> ()> factory,
+                                              std::function<real_t (GradientModule &, const vector_t &)> fn,
+                                              GradientModule &mod,
+                                              const vector_t &input,
+                                              real_t eps,
+                                              thread_pool &pool)
+    {
+        fn(mod, input);
+        
+        auto grad = gradient_values(mod);
+        auto params = parameter_values(mod);
+        const std::size_t n = params.size();
+        
+        // one clone per thread (including the one waiting below)
+        const std::size_t slices = std::max<std::size_t>(std::min(pool.size() + 1, n), 1);
+        
+        std::vector<std::shared_ptr<GradientModule>> clones;
+        std::vector<std::vector<real_t *>> clone_params;
+        for (std::size_t k = 0; k < slices; k++) {
+            clones.push_back(factory());
+            clone_params.push_back(parameter_values(*clones.back()));
+            
+            if (clone_params.back().size() != n)
+                throw std::invalid_argument("check_gradient_parallel: clone has different parameters");
+            
+            for (std::size_t i = 0; i < n; i++)
+                *clone_params.back()[i] = *params[i];
+        }
+        
+        std::vector<real_t> diffs(n);
+        
+        task_group group(pool);
+        for (std::size_t k = 0; k < slices; k++) {
+            group.run([&, k]() {
+                GradientModule &clone = *clones[k];
+                auto eval = [&]() { return fn(clone, input); };
+                
+                for (std::size_t i = k*n/slices; i < (k + 1)*n/slices; i++)
+                    diffs[i] = std::fabs(difference(eval, clone_params[k][i], eps) - grad[i]);
+            });
         }
+        group.wait();
         
-        return std::move(result);
+        return std::list<real_t>(diffs.begin(), diffs.end());
     }
-}
\ No newline at end of file
+}
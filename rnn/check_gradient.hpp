@@ -18,12 +18,56 @@
 #pragma GCC visibility push(default)
 
 #include "module.hpp"
+#include "thread_pool.hpp"
 
 namespace gnol {
+    /*!
+     Compares the gradient that fn leaves in mod against a central
+     difference for every parameter, returning the absolute error of each.
+     fn has to clear mod, run forward and backward, and return the loss.
+     This costs two calls of fn per parameter.
+     */
     std::list<real_t> check_gradient(std::function<real_t (const vector_t &)> fn,
                                     GradientModule &mod,
                                     const vector_t &input,
                                     real_t eps);
+    
+    /*!
+     Compares the gradient projected onto random unit directions against a
+     central difference along each direction, returning the absolute error
+     for each direction. A wrong gradient almost surely shows up in any
+     direction, so a handful of them (two calls of fn each) check every
+     parameter at once.
+     */
+    std::list<real_t> check_gradient_directional(std::function<real_t (const vector_t &)> fn,
+                                                 GradientModule &mod,
+                                                 const vector_t &input,
+                                                 real_t eps,
+                                                 std::size_t directions=4,
+                                                 unsigned seed=0);
+    
+    /*!
+     Like check_gradient(), but only for a random sample of the parameters.
+     */
+    std::list<real_t> check_gradient_sampled(std::function<real_t (const vector_t &)> fn,
+                                             GradientModule &mod,
+                                             const vector_t &input,
+                                             real_t eps,
+                                             std::size_t samples=32,
+                                             unsigned seed=0);
+    
+    /*!
+     Exhaustive check that splits the parameters into slices, each
+     perturbed on its own clone of mod (built by factory, with mod's
+     parameter values copied over) on pool. fn runs the same computation
+     as for check_gradient() on whichever module it is given.
+     */
+    std::list<real_t> check_gradient_parallel(std::function<std::shared_ptr<GradientModule> ()> factory,
+                                              std::function<real_t (GradientModule &, const vector_t &)> fn,
+                                              GradientModule &mod,
+                                              const vector_t &input,
+                                              real_t eps,
+                                              thread_pool &pool=thread_pool::global());
 }
 
 #pragma GCC visibility pop
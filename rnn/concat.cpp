@@ -8,6 +8,8 @@
 
 #include "concat.hpp"
 
+#include <set>
+
 using namespace gnol;
 
 InputModule::InputModule(ssize_t<1> size):
@@ -26,6 +28,98 @@ matrix_t &InputModule::backward(const matrix_t &input, const matrix_t &grad_outp
     return grad_input;
 }
 
+namespace {
+    /*!
+     Points the output of mod at rows [first, first+count) of output, so
+     the module's forward writes its result straight into the parent.
+     Only a single column has contiguous rows, so batches are left alone
+     and copied by gather_output() instead.
+     */
+    void bind_output(GradientModule &mod, matrix_t &output, std::size_t first, std::size_t count) {
+        if (output.n_cols != 1 || count == 0)
+            return;
+        
+        real_t *slice = output.memptr() + first;
+        matrix_t &current = *mod.get_output();
+        
+        if (current.memptr() != slice || current.n_rows != count || current.n_cols != 1)
+            mod.get_output().rebind(slice, count, 1, false);
+    }
+    
+    // copies result into its rows of output, unless the module already
+    // wrote it there
+    void gather_output(const matrix_t &result, matrix_t &output, std::size_t first, std::size_t count) {
+        if (count == 0 || (output.n_cols == 1 && result.memptr() == output.memptr() + first))
+            return;
+        
+        output.rows(first, first+count-1) = result;
+    }
+    
+    // calls fn with rows [first, first+count) of m, as a view when they
+    // are contiguous and as a copy otherwise
+    template <typename FnT>
+    void with_rows(const matrix_t &m, std::size_t first, std::size_t count, FnT fn) {
+        if (m.n_cols == 1) {
+            const matrix_t view(const_cast<real_t *>(m.memptr()) + first, count, 1, false, true);
+            fn(view);
+        } else {
+            const matrix_t copy = m.rows(first, first+count-1);
+            fn(copy);
+        }
+    }
+}
+
+branch_scheduler::branch_scheduler(const std::vector<std::shared_ptr<GradientModule>> &modules):
+    independent(true),
+    grain(default_grain)
+{
+    std::set<const GradientModule *> seen_modules;
+    std::set<const real_t *> seen_storage;
+    
+    for (auto mod : modules) {
+        std::size_t length = 0;
+        for (auto &param : mod->flatten_parameters())
+            length += param.size();
+        
+        weights.push_back(length + mod->get_output_size()[0]);
+        
+        // every module of the branch, not just its top, as a module used
+        // in two branches (even one without parameters) writes its
+        // outputs and gradients from both; modules within one branch
+        // are only counted once
+        std::set<const GradientModule *> branch_modules;
+        mod->visit_modules([&](GradientModule &inner) { branch_modules.insert(&inner); });
+        
+        for (auto inner : branch_modules) {
+            if (!seen_modules.insert(inner).second)
+                independent = false;
+        }
+        
+        // flattened rather than visited, so modules keeping their
+        // parameters inline (StaticSequence) are covered too
+        std::set<const real_t *> branch_storage;
+        for (auto &grad : mod->flatten_deriv_parameters()) {
+            if (!grad.empty())
+                branch_storage.insert(&*grad.begin());
+        }
+        
+        for (auto memory : branch_storage) {
+            if (!seen_storage.insert(memory).second)
+                independent = false;
+        }
+    }
+}
+
+template <typename PredT>
+bool any_module(const std::vector<std::shared_ptr<GradientModule>> &modules, PredT pred) {
+    for (auto mod : modules) {
+        if (pred(*mod))
+            return true;
+    }
+    
+    return false;
+}
+
 std::size_t add_module_input_sizes(const std::list<std::shared_ptr<GradientModule>> &modules) {
     std::size_t sz = 0;
     for (auto mod : modules)
@@ -43,36 +137,53 @@ std::size_t add_module_output_sizes(const std::list<std::shared_ptr<GradientModu
 }
 
 ConcatModule::ConcatModule(std::list<std::shared_ptr<GradientModule>> modules):
-    modules(modules),
     GradientModule(modules.front()->get_input_size(),
-                   add_module_output_sizes(modules)) {}
+                   add_module_output_sizes(modules)),
+    modules(modules.begin(), modules.end()),
+    scheduler(this->modules)
+{
+    std::size_t j = 0;
+    for (auto mod : this->modules) {
+        output_offsets.push_back(j);
+        j += mod->get_output_size()[0];
+    }
+}
 
 matrix_t &ConcatModule::forward(const matrix_t &input) {
-    matrix_t::iterator pos = output->begin();
-    for (auto mod : modules) {
-        mod->forward(input);
-        
-        // copy result of forward to section of output
-        pos = std::copy(mod->get_output()->begin(),
-                        mod->get_output()->end(),
-                        pos);        
-    }
+    // one column per sample in the batch
+    output->set_size(output_size[0], input.n_cols);
+    matrix_t &result = *output;
     
-    return *output;
+    // have each module write to its section of output
+    for (std::size_t k = 0; k < modules.size(); k++)
+        bind_output(*modules[k], result, output_offsets[k], modules[k]->get_output_size()[0]);
+    
+    scheduler.run(input.n_cols, [&](std::size_t k) {
+        gather_output(modules[k]->forward(input), result,
+                      output_offsets[k], modules[k]->get_output_size()[0]);
+    });
+    
+    return result;
 }
 
 matrix_t &ConcatModule::backward(const matrix_t &input, const matrix_t &grad_output) {
-    std::size_t i = 0;
+    match_grad_input(input);
     
-    for (auto mod : modules) {
+    scheduler.run(input.n_cols, [&](std::size_t k) {
+        auto &mod = modules[k];
         if (mod->get_input_size().dims() == 1) {
-            const std::size_t output_size = mod->get_output_size()[0];
-            vector_t ginput(mod->get_output_size()[0]);
-            grad_input += mod->backward(input, grad_output(span(i, i+output_size-1), 0));
-            i += output_size;
+            with_rows(grad_output, output_offsets[k], mod->get_output_size()[0],
+                      [&](const matrix_t &grad) { mod->backward(input, grad); });
         } else {
             // TODO
         }
+    });
+    
+    // the sum is left until every module is done so the modules don't
+    // race on grad_input
+    for (auto mod : modules) {
+        if (mod->get_input_size().dims() == 1)
+            grad_input += mod->get_grad_input();
     }
     
     return grad_input;
@@ -80,11 +191,11 @@ matrix_t &ConcatModule::backward(const matrix_t &input, const matrix_t &grad_out
 
 parameter_list ConcatModule::flatten_parameters() {
     parameter_list params;
-    std::insert_iterator<parameter_list> insert(params, params.end());
     
+    // splice rather than copy so the nodes are only allocated once
     for (auto mod : modules) {
         auto mod_params = mod->flatten_parameters();
-        std::copy(mod_params.begin(), mod_params.end(), insert);
+        params.splice(params.end(), mod_params);
     }
     
     return params;
@@ -92,67 +203,109 @@ parameter_list ConcatModule::flatten_parameters() {
 
 parameter_list ConcatModule::flatten_deriv_parameters() {
     parameter_list params;
-    std::insert_iterator<parameter_list> insert(params, params.end());
     
+    // splice rather than copy so the nodes are only allocated once
     for (auto mod : modules) {
         auto mod_params = mod->flatten_deriv_parameters();
-        std::copy(mod_params.begin(), mod_params.end(), insert);
+        params.splice(params.end(), mod_params);
     }
     
     return params;
 }
 
+void ConcatModule::visit_parameters(parameter_visitor &visitor) {
+    for (auto mod : modules)
+        mod->visit_parameters(visitor);
+}
+
+void ConcatModule::visit_deriv_parameters(parameter_visitor &visitor) {
+    for (auto mod : modules)
+        mod->visit_deriv_parameters(visitor);
+}
+
+void ConcatModule::visit_modules(const module_visitor &visitor) {
+    visitor(*this);
+    for (auto mod : modules)
+        mod->visit_modules(visitor);
+}
+
+void ConcatModule::freeze() {
+    for (auto mod : modules)
+        mod->freeze();
+    
+    GradientModule::freeze();
+}
+
+bool ConcatModule::backward_uses_input() const {
+    return any_module(modules, [](GradientModule &mod) { return mod.backward_uses_input(); });
+}
+
+// the outputs of the modules are (views into) this module's output
+bool ConcatModule::backward_uses_output() const {
+    return any_module(modules, [](GradientModule &mod) { return mod.backward_uses_output(); });
+}
+
 JoinModule::JoinModule(std::list<std::shared_ptr<GradientModule>> modules):
-    modules(modules),
     GradientModule(add_module_input_sizes(modules),
-                   add_module_output_sizes(modules)) {}
-
-matrix_t &JoinModule::forward(const matrix_t &input) {
+                   add_module_output_sizes(modules)),
+    modules(modules.begin(), modules.end()),
+    scheduler(this->modules)
+{
     std::size_t i = 0;
     std::size_t j = 0;
     
-    for (auto mod : modules) {
-        const std::size_t input_size = mod->get_input_size()[0];
-        const std::size_t output_size = mod->get_output_size()[0];
-        
-        // forward slice of input to each module
-        mod->forward(input(span(i, i+input_size-1), 0));
-        
-        // copy result of forward to slice of output
-        (*output)(span(j, j+output_size-1), 0) = *mod->get_output();
-        
-        // increment index into input
-        i += input_size;
-        j += output_size;
+    for (auto mod : this->modules) {
+        input_offsets.push_back(i);
+        output_offsets.push_back(j);
+        i += mod->get_input_size()[0];
+        j += mod->get_output_size()[0];
     }
+}
+
+matrix_t &JoinModule::forward(const matrix_t &input) {
+    // one column per sample in the batch
+    output->set_size(output_size[0], input.n_cols);
+    matrix_t &result = *output;
     
-    return *output;
+    for (std::size_t k = 0; k < modules.size(); k++)
+        bind_output(*modules[k], result, output_offsets[k], modules[k]->get_output_size()[0]);
+    
+    // forward slice of input to each module, which writes to its slice
+    // of output
+    scheduler.run(input.n_cols, [&](std::size_t k) {
+        auto &mod = modules[k];
+        with_rows(input, input_offsets[k], mod->get_input_size()[0], [&](const matrix_t &slice) {
+            gather_output(mod->forward(slice), result, output_offsets[k], mod->get_output_size()[0]);
+        });
+    });
+    
+    return result;
 }
 
 matrix_t &JoinModule::backward(const matrix_t &input, const matrix_t &grad_output) {
-    std::size_t i = 0;
-    std::size_t j = 0;
+    match_grad_input(input);
     
-    for (auto mod : modules) {
+    // each module writes to its own rows of grad_input, so they can run
+    // side by side
+    scheduler.run(input.n_cols, [&](std::size_t k) {
+        auto &mod = modules[k];
         if (mod->get_input_size().dims() == 1) {
             const std::size_t input_size = mod->get_input_size()[0];
-            const std::size_t output_size = mod->get_output_size()[0];
+            const std::size_t i = input_offsets[k];
 
             // backward slice of grad_output to each module with the same
             // input slice that was given in the forward phase
-            mod->backward(input(span(i, i+input_size-1), 0),
-                          grad_output(span(j, j+output_size-1), 0));
+            with_rows(input, i, input_size, [&](const matrix_t &slice) {
+                with_rows(grad_output, output_offsets[k], mod->get_output_size()[0],
+                          [&](const matrix_t &grad) { mod->backward(slice, grad); });
+            });
             
             // copy result of backward to slice of grad_input
-            grad_input(span(i, i+input_size-1), 0) = mod->get_grad_input();
-            
-            // increment index to input and grad_output
-            i += input_size;
-            j += output_size;
+            grad_input.rows(i, i+input_size-1) = mod->get_grad_input();
         } else {
             // TODO
         }
-    }
+    });
     
     return grad_input;
 }
@@ -182,3 +335,34 @@ parameter_list JoinModule::flatten_deriv_parameters() {
 //    return params;
      return modules.front()->flatten_deriv_parameters();
 }
+
+void JoinModule::visit_parameters(parameter_visitor &visitor) {
+    for (auto mod : modules)
+        mod->visit_parameters(visitor);
+}
+
+void JoinModule::visit_deriv_parameters(parameter_visitor &visitor) {
+    for (auto mod : modules)
+        mod->visit_deriv_parameters(visitor);
+}
+
+void JoinModule::visit_modules(const module_visitor &visitor) {
+    visitor(*this);
+    for (auto mod : modules)
+        mod->visit_modules(visitor);
+}
+
+void JoinModule::freeze() {
+    for (auto mod : modules)
+        mod->freeze();
+    
+    GradientModule::freeze();
+}
+
+bool JoinModule::backward_uses_input() const {
+    return any_module(modules, [](GradientModule &mod) { return mod.backward_uses_input(); });
+}
+
+bool JoinModule::backward_uses_output() const {
+    return any_module(modules, [](GradientModule &mod) { return mod.backward_uses_output(); });
+}
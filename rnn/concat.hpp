@@ -9,9 +9,82 @@
 #ifndef concat_hpp
 #define concat_hpp
 
+#include <vector>
+
 #include "module.hpp"
+#include "thread_pool.hpp"
 
 namespace gnol {
+    /*!
+     Runs the branches of a multi-branch module, handing those worth it to
+     the global thread_pool. A branch's cost is estimated as its number of
+     parameters and outputs times the batch size; branches below the grain
+     size run inline on the calling thread.
+     
+     Branches only run in parallel when no two of them share a module (at
+     any depth, see GradientModule::visit_modules) or gradient storage,
+     since their outputs and gradients would otherwise race.
+     */
+    class branch_scheduler {
+        std::vector<std::size_t> weights;
+        bool independent;
+        std::size_t grain;
+    public:
+        static const std::size_t default_grain = 1 << 16;
+        
+        branch_scheduler(const std::vector<std::shared_ptr<GradientModule>> &modules);
+        
+        void set_grain(std::size_t grain) { this->grain = grain; }
+        std::size_t get_grain() const { return grain; }
+        bool is_independent() const { return independent; }
+        
+        // calls fn(i) for every branch i, returning once all are done
+        template <typename FnT>
+        void run(std::size_t batch_size, FnT fn);
+    };
+    
+    template <typename FnT>
+    void branch_scheduler::run(std::size_t batch_size, FnT fn) {
+        const std::size_t n = weights.size();
+        std::vector<bool> submitted(n, false);
+        std::size_t heavy = 0;
+        
+        if (independent && n > 1 && thread_pool::global().size() > 0) {
+            for (std::size_t i = 0; i < n; i++) {
+                submitted[i] = weights[i]*batch_size >= grain;
+                heavy += submitted[i];
+            }
+        }
+        
+        if (heavy == 0) {
+            for (std::size_t i = 0; i < n; i++)
+                fn(i);
+            return;
+        }
+        
+        // the last heavy branch runs here along with the light ones, so the
+        // calling thread isn't left just waiting
+        for (std::size_t i = n; i-- > 0;) {
+            if (submitted[i]) {
+                submitted[i] = false;
+                break;
+            }
+        }
+        
+        task_group group;
+        for (std::size_t i = 0; i < n; i++) {
+            if (submitted[i])
+                group.run([&fn, i]() { fn(i); });
+        }
+        
+        for (std::size_t i = 0; i < n; i++) {
+            if (!submitted[i])
+                fn(i);
+        }
+        
+        group.wait();
+    }
+    
     class InputModule: public GradientModule {
     public:
         InputModule(ssize_t<1> size);
@@ -38,15 +111,35 @@ namespace gnol {
      
      std::cout << output.n_rows << std::endl;
      // 10
+     
+     For a single sample each module writes its output (and reads its
+     slice of the gradient) directly in the ConcatModule's buffers, so
+     nesting concatenations doesn't copy anything. Batches have to be
+     copied, since a block of rows is not contiguous across columns. As
+     the outputs of the modules live in the ConcatModule's output, it has
+     to be kept until backward whenever one of them needs its own output.
+     
+     Independent modules run in parallel (see branch_scheduler).
      */
     class ConcatModule: public GradientModule {
-        std::list<std::shared_ptr<GradientModule>> modules;
+        std::vector<std::shared_ptr<GradientModule>> modules;
+        std::vector<std::size_t> output_offsets;
+        branch_scheduler scheduler;
     public:
         ConcatModule(std::list<std::shared_ptr<GradientModule>> modules);
+        
+        void set_grain(std::size_t grain) { scheduler.set_grain(grain); }
+        
         matrix_t &forward(const matrix_t &input);
         matrix_t &backward(const matrix_t &input, const matrix_t &grad_output);
         parameter_list flatten_parameters();
         parameter_list flatten_deriv_parameters();
+        void visit_parameters(parameter_visitor &visitor);
+        void visit_deriv_parameters(parameter_visitor &visitor);
+        void visit_modules(const module_visitor &visitor);
+        void freeze();
+        bool backward_uses_input() const;
+        bool backward_uses_output() const;
     };
     
     std::shared_ptr<ConcatModule> make_concat(std::list<std::shared_ptr<GradientModule>> modules) {
@@ -55,16 +148,28 @@ namespace gnol {
     
     /*!
      JoinModule takes the output of all modules and concatenates them into
-     a single vector.
+     a single vector. Like ConcatModule, a single sample is sliced and
+     joined without copies, and independent modules run in parallel.
      */
     class JoinModule: public GradientModule {
-        std::list<std::shared_ptr<GradientModule>> modules;
+        std::vector<std::shared_ptr<GradientModule>> modules;
+        std::vector<std::size_t> input_offsets, output_offsets;
+        branch_scheduler scheduler;
     public:
         JoinModule(std::list<std::shared_ptr<GradientModule>> modules);
+        
+        void set_grain(std::size_t grain) { scheduler.set_grain(grain); }
+        
         matrix_t &forward(const matrix_t &input);
         matrix_t &backward(const matrix_t &input, const matrix_t &grad_output);
         parameter_list flatten_parameters();
         parameter_list flatten_deriv_parameters();
+        void visit_parameters(parameter_visitor &visitor);
+        void visit_deriv_parameters(parameter_visitor &visitor);
+        void visit_modules(const module_visitor &visitor);
+        void freeze();
+        bool backward_uses_input() const;
+        bool backward_uses_output() const;
     };
 }
 
@@ -0,0 +1,78 @@
+//
+//  context.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/17/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "context.hpp"
+#include "arena.hpp"
+
+namespace gnol {
+    execution_context::execution_context(module_ptr state, GradientModule &model, mode_t mode):
+        state(state),
+        mode(mode)
+    {
+        // drops the copy's own parameters for views of the model's
+        tie_parameters(*state, model);
+
+        if (mode == inference)
+            state->freeze();
+    }
+
+    shared_model::shared_model(factory_t factory):
+        shared_model(factory, factory()) {}
+
+    shared_model::shared_model(factory_t factory, module_ptr model):
+        factory(factory),
+        model(model),
+        total(0) {}
+
+    std::size_t shared_model::size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total;
+    }
+
+    shared_model::lease_t shared_model::acquire(mode_t mode) {
+        std::unique_ptr<execution_context> context;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &pool = idle[mode];
+
+            if (!pool.empty()) {
+                context = std::move(pool.back());
+                pool.pop_back();
+            } else {
+                total++;
+            }
+        }
+
+        // building a context only reads the model, so it's done without
+        // holding up the other threads
+        if (!context) {
+            try {
+                context.reset(new execution_context(factory(), *model, mode));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                total--;
+                throw;
+            }
+        }
+
+        return lease_t(context.release(), [this](execution_context *c) { release(c); });
+    }
+
+    void shared_model::release(execution_context *context) {
+        std::unique_ptr<execution_context> owned(context);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        idle[owned->get_mode()].push_back(std::move(owned));
+    }
+
+    matrix_t shared_model::forward(const matrix_t &input) {
+        auto context = acquire();
+        return context->forward(input);
+    }
+}
@@ -0,0 +1,131 @@
+//
+//  context.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/17/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef context_hpp
+#define context_hpp
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "module.hpp"
+
+namespace gnol {
+    /*!
+     Everything one invocation of a model writes to. A context is a copy
+     of the model whose parameters are views of the model's (see
+     tie_parameters), so the weights aren't copied.
+
+     An inference context is frozen (see GradientModule::freeze), so it
+     holds the outputs of one forward and nothing else. A training
+     context also keeps the gradients of one call, parameters included:
+     each concurrent backward needs somewhere of its own to accumulate
+     them, so that costs about one set of weights per context.
+
+     A context must only be used by one thread at a time.
+     */
+    class execution_context {
+    public:
+        typedef std::shared_ptr<GradientModule> module_ptr;
+        enum mode_t { inference, training };
+    protected:
+        module_ptr state;
+        mode_t mode;
+    public:
+        execution_context(module_ptr state, GradientModule &model, mode_t mode=inference);
+
+        GradientModule &get_module() { return *state; }
+        mode_t get_mode() const { return mode; }
+
+        // the result stays valid until the next call on this context
+        matrix_t &forward(const matrix_t &input) { return state->forward(input); }
+
+        matrix_t &backward(const matrix_t &input, const matrix_t &grad_output) {
+            return state->backward(input, grad_output);
+        }
+
+        void clear() { state->clear(); }
+    };
+
+    /*!
+     shared_model lets any number of threads run one model at once. The
+     parameters are only held by the model; every call runs in an
+     execution_context of its own, taken from a pool that grows to the
+     number of calls in flight and is reused after that.
+
+     Contexts are handed out for inference unless asked for training;
+     each kind has a pool of its own, so a context always comes back
+     the way it was made.
+
+     The factory has to build the same network as the model every time it
+     is called. Parameters are only read while running, so the model can
+     be bound read only to a mapped_model shared between processes.
+
+     Contexts point at the storage of the model's parameters as it is
+     when they're made. Anything that moves that storage (binding it to
+     a mapped_model, or building a parameter_arena or an Optimizer on
+     get_model()) has to happen before the first context is made, or
+     every context is left reading freed memory.
+
+     \code
+     shared_model model([]() {
+        return make_sequence({
+           make_module<LinearModule>(size(10, 5)),
+           make_module<SigmoidModule>(5)
+        });
+     });
+
+     // from any thread
+     matrix_t output = model.forward(input);
+
+     // or, keeping the buffers of the call around
+     auto context = model.acquire();
+     matrix_t &output = context->forward(input);
+
+     // with gradients
+     auto trainable = model.acquire(execution_context::training);
+     */
+    class shared_model {
+    public:
+        typedef execution_context::module_ptr module_ptr;
+        typedef execution_context::mode_t mode_t;
+        typedef std::function<module_ptr ()> factory_t;
+
+        // hands the context back to the pool when it goes away
+        typedef std::unique_ptr<execution_context, std::function<void (execution_context *)>> lease_t;
+    protected:
+        factory_t factory;
+        module_ptr model;
+
+        std::mutex mutex;
+        // idle contexts of each mode
+        std::vector<std::unique_ptr<execution_context>> idle[2];
+        std::size_t total;
+    public:
+        explicit shared_model(factory_t factory);
+        shared_model(factory_t factory, module_ptr model);
+
+        shared_model(const shared_model &) = delete;
+        shared_model &operator =(const shared_model &) = delete;
+
+        GradientModule &get_model() { return *model; }
+
+        // number of contexts made so far
+        std::size_t size();
+
+        lease_t acquire(mode_t mode=execution_context::inference);
+
+        // runs input through the model in an inference context
+        matrix_t forward(const matrix_t &input);
+    protected:
+        void release(execution_context *context);
+    };
+}
+
+#endif /* context_hpp */
@@ -8,30 +8,143 @@
 
 #include "convolve.hpp"
 
-using namespace gnol;
-
-void convolve2d(const matrix_t &input, const matrix_t &kernel, matrix_t &output) {
-    ssize_t<2> center({input.n_rows, input.n_cols});
-    
-    for (std::uint64_t i = 0; i < input.n_rows; i++) {
-        for (std::uint64_t j = 0; j < input.n_cols; j++) {
-            for (std::uint64_t m = 0; m < kernel.n_rows; m++) {
-                // row index of flipped kernel
-                std::size_t fm = kernel.n_rows -1 - m;
-                
-                for (std::size_t n=0; n < kernel.n_cols; n++) {
-                    std::size_t fn = kernel.n_cols - 1 - n;
-                    
-                    std::int64_t ii = i + (m - center[0]);
-                    std::int64_t jj = j + (n - center[1]);
-                    
-                    // make sure we are within bounds
-                    if (ii >= 0 && ii < input.n_rows && jj >= 0 && jj < input.n_cols) {
-                        output(i, j) += input(ii, jj) * kernel(fm, fn);
+#include <algorithm>
+#include <cstdint>
+
+namespace gnol {
+    namespace {
+        /*!
+         Finds the range [first, last) of output positions o for which
+         o*stride - padding + offset falls inside [0, extent). Computing
+         this up front keeps the bounds check out of the inner loops.
+         */
+        void valid_range(std::size_t offset, std::size_t extent,
+                         std::size_t outputs, std::size_t stride, std::size_t padding,
+                         std::size_t &first, std::size_t &last)
+        {
+            const std::int64_t low = std::int64_t(padding) - std::int64_t(offset);
+            const std::int64_t high = std::int64_t(extent) - 1 + low;
+
+            first = low > 0 ? std::size_t((low + stride - 1)/stride) : 0;
+            last = high >= 0 ? std::min(outputs, std::size_t(high/stride) + 1) : 0;
+            last = std::max(first, last);
+        }
+    }
+
+    void im2col(const Convolve2DGeometry &g, const real_t *image, matrix_t &patches) {
+        const std::size_t out_rows = g.output_rows();
+        const std::size_t out_cols = g.output_cols();
+
+        patches.zeros(g.positions(), g.patch_size());
+
+        std::size_t column = 0;
+        for (std::size_t c = 0; c < g.channels; c++) {
+            const real_t *channel = image + c*g.rows*g.cols;
+
+            for (std::size_t kj = 0; kj < g.kernel_cols; kj++) {
+                std::size_t j0, j1;
+                valid_range(kj, g.cols, out_cols, g.stride, g.padding_cols, j0, j1);
+
+                for (std::size_t ki = 0; ki < g.kernel_rows; ki++, column++) {
+                    std::size_t i0, i1;
+                    valid_range(ki, g.rows, out_rows, g.stride, g.padding_rows, i0, i1);
+
+                    real_t *dst = patches.colptr(column);
+                    for (std::size_t oj = j0; oj < j1; oj++) {
+                        const real_t *src = channel + (oj*g.stride + kj - g.padding_cols)*g.rows;
+                        real_t *out = dst + oj*out_rows;
+
+                        std::size_t ii = i0*g.stride + ki - g.padding_rows;
+                        for (std::size_t oi = i0; oi < i1; oi++, ii += g.stride)
+                            out[oi] = src[ii];
                     }
                 }
             }
         }
     }
-}
 
+    void col2im(const Convolve2DGeometry &g, const matrix_t &patches, real_t *image) {
+        const std::size_t out_rows = g.output_rows();
+        const std::size_t out_cols = g.output_cols();
+
+        std::size_t column = 0;
+        for (std::size_t c = 0; c < g.channels; c++) {
+            real_t *channel = image + c*g.rows*g.cols;
+
+            for (std::size_t kj = 0; kj < g.kernel_cols; kj++) {
+                std::size_t j0, j1;
+                valid_range(kj, g.cols, out_cols, g.stride, g.padding_cols, j0, j1);
+
+                for (std::size_t ki = 0; ki < g.kernel_rows; ki++, column++) {
+                    std::size_t i0, i1;
+                    valid_range(ki, g.rows, out_rows, g.stride, g.padding_rows, i0, i1);
+
+                    const real_t *src = patches.colptr(column);
+                    for (std::size_t oj = j0; oj < j1; oj++) {
+                        real_t *dst = channel + (oj*g.stride + kj - g.padding_cols)*g.rows;
+                        const real_t *in = src + oj*out_rows;
+
+                        std::size_t ii = i0*g.stride + ki - g.padding_rows;
+                        for (std::size_t oi = i0; oi < i1; oi++, ii += g.stride)
+                            dst[ii] += in[oi];
+                    }
+                }
+            }
+        }
+    }
+
+    void convolve2d(const matrix_t &input, const matrix_t &kernel, matrix_t &output) {
+        Convolve2DGeometry g(size(1, input.n_rows, input.n_cols),
+                             size(1, kernel.n_rows, kernel.n_cols),
+                             1, kernel.n_rows/2, kernel.n_cols/2);
+
+        matrix_t patches;
+        im2col(g, input.memptr(), patches);
+
+        // a convolution is a correlation with the flipped kernel
+        matrix_t flipped = fliplr(flipud(kernel));
+        output.set_size(g.output_rows(), g.output_cols());
+
+        matrix_t result(output.memptr(), g.positions(), 1, false, true);
+        result = patches*vectorise(flipped);
+    }
+
+    void Convolve2DTransform::operator()(Convolve2DParams &params, const matrix_t &input, matrix_t &output) {
+        const Convolve2DGeometry &g = params.geometry;
+
+        output.set_size(g.output_size(), input.n_cols);
+
+        for (std::size_t n = 0; n < input.n_cols; n++) {
+            im2col(g, input.colptr(n), patches);
+
+            // view the sample's output as one column per filter
+            matrix_t features(output.colptr(n), g.positions(), g.filters, false, true);
+            features = patches*(*params.kernel);
+            features.each_row() += params.bias->t();
+        }
+    }
+
+    void Convolve2DGradient::operator()(Convolve2DParams &params, Convolve2DGradParams &gparams, const matrix_t &input, const matrix_t &grad_output, matrix_t &grad_input) {
+        const Convolve2DGeometry &g = params.geometry;
+
+        for (std::size_t n = 0; n < input.n_cols; n++) {
+            const matrix_t grad_features(const_cast<real_t *>(grad_output.colptr(n)),
+                                         g.positions(), g.filters, false, true);
+
+            // the patches are recomputed rather than kept from forward so
+            // only one sample's worth is ever alive at a time
+            im2col(g, input.colptr(n), patches);
+
+            *gparams.kernel += patches.t()*grad_features;
+            *gparams.bias += sum(grad_features, 0).t();
+
+            grad_patches = grad_features*params.kernel->t();
+            col2im(g, grad_patches, grad_input.colptr(n));
+        }
+    }
+
+    Convolve2DModule::Convolve2DModule(const Convolve2DGeometry &geometry):
+        ParameterizedModule(Convolve2DParams(geometry),
+                            Convolve2DGradParams(geometry),
+                            {geometry.input_size(), geometry.output_size()}) {}
+}
@@ -9,72 +9,198 @@
 #ifndef __rnn__convolve__
 #define __rnn__convolve__
 
+#include <stdexcept>
+
 #include "module.hpp"
 
 namespace gnol {
+    /*!
+     Shape of a 2D convolution over a multi-channel image. Images are
+     stored as a single column (so they can be batched like any other
+     input) with each channel stored contiguously in column-major order.
+     Padding can differ between the two axes, e.g. to keep the size of the
+     image with a kernel that isn't square.
+     */
+    struct Convolve2DGeometry {
+        std::size_t channels, rows, cols;
+        std::size_t filters, kernel_rows, kernel_cols;
+        std::size_t stride, padding_rows, padding_cols;
+
+        Convolve2DGeometry(ssize_t<3> input_size,
+                           ssize_t<3> kernel_size,
+                           std::size_t stride=1,
+                           std::size_t padding=0):
+            Convolve2DGeometry(input_size, kernel_size, stride, padding, padding) {}
+
+        Convolve2DGeometry(ssize_t<3> input_size,
+                           ssize_t<3> kernel_size,
+                           std::size_t stride,
+                           std::size_t padding_rows,
+                           std::size_t padding_cols):
+            channels(input_size[0]), rows(input_size[1]), cols(input_size[2]),
+            filters(kernel_size[0]), kernel_rows(kernel_size[1]), kernel_cols(kernel_size[2]),
+            stride(stride), padding_rows(padding_rows), padding_cols(padding_cols)
+        {
+            if (stride == 0)
+                throw std::invalid_argument("Convolve2DGeometry: stride has to be at least 1");
+
+            if (kernel_rows > rows + 2*padding_rows || kernel_cols > cols + 2*padding_cols)
+                throw std::invalid_argument("Convolve2DGeometry: kernel is larger than the padded input");
+        }
+
+        std::size_t output_rows() const { return (rows + 2*padding_rows - kernel_rows)/stride + 1; }
+        std::size_t output_cols() const { return (cols + 2*padding_cols - kernel_cols)/stride + 1; }
+
+        std::size_t input_size() const { return channels*rows*cols; }
+        std::size_t output_size() const { return filters*output_rows()*output_cols(); }
+
+        // number of output positions of a single filter
+        std::size_t positions() const { return output_rows()*output_cols(); }
+
+        // number of input values a single output position depends on
+        std::size_t patch_size() const { return channels*kernel_rows*kernel_cols; }
+    };
+
+    /*!
+     Unrolls every receptive field of image into a row of patches, so the
+     convolution becomes a single matrix product. patches must be
+     positions() x patch_size().
+     */
+    void im2col(const Convolve2DGeometry &geometry, const real_t *image, matrix_t &patches);
+
+    /*!
+     Adjoint of im2col: accumulates each row of patches back into the
+     positions of image it was read from.
+     */
+    void col2im(const Convolve2DGeometry &geometry, const matrix_t &patches, real_t *image);
+
+    /*!
+     Single channel convolution (with a flipped kernel) that keeps the size
+     of input. The kernel dimensions are expected to be odd.
+     */
     void convolve2d(const matrix_t &input, const matrix_t &kernel, matrix_t &output);
 
     struct Convolve2DParams {
+        Convolve2DGeometry geometry;
+
+        // one column per filter, one row per element of a patch
         variable<matrix_t> kernel;
-        
+        variable<vector_t> bias;
+
+        Convolve2DParams(Convolve2DParams &&params):
+            geometry(params.geometry),
+            kernel(params.kernel),
+            bias(params.bias) {}
+
+        Convolve2DParams(const Convolve2DGeometry &geometry):
+            geometry(geometry),
+            kernel(size(geometry.patch_size(), geometry.filters)),
+            bias(geometry.filters)
+        {
+            kernel->randu();
+            bias->randu();
+        }
+
+        Convolve2DParams(const Convolve2DGeometry &geometry,
+                         variable<matrix_t> &&kernel,
+                         variable<vector_t> &&bias):
+            geometry(geometry),
+            kernel(kernel),
+            bias(bias) {}
+
         parameter_list flatten() {
             parameter_list params = {
                 boost::make_iterator_range(kernel->begin(), kernel->end()),
+                boost::make_iterator_range(bias->begin(), bias->end())
             };
-            
+
             return std::move(params);
         }
+
+        void visit(parameter_visitor &visitor) {
+            visitor(kernel);
+            visitor(bias);
+        }
     };
 
     struct Convolve2DGradParams {
         variable<matrix_t> kernel;
-        
-        Convolve2DGradParams(ssize_t<2> size):
-        kernel(size)
-        {
-            clear();
-        }
-        
-        Convolve2DGradParams(variable<matrix_t> &kernel):
-        kernel(kernel)
+        variable<vector_t> bias;
+
+        Convolve2DGradParams(Convolve2DGradParams &&params):
+            kernel(params.kernel),
+            bias(params.bias) {}
+
+        Convolve2DGradParams(const Convolve2DGeometry &geometry):
+            kernel(size(geometry.patch_size(), geometry.filters)),
+            bias(geometry.filters)
         {
             clear();
         }
-        
-        Convolve2DGradParams(variable<matrix_t> &&kernel):
-        kernel(kernel)
+
+        Convolve2DGradParams(variable<matrix_t> &&kernel, variable<vector_t> &&bias):
+            kernel(kernel),
+            bias(bias)
         {
             clear();
         }
-        
+
         void clear() {
             kernel->zeros();
+            bias->zeros();
         }
-        
+
         parameter_list flatten() {
             parameter_list params = {
                 boost::make_iterator_range(kernel->begin(), kernel->end()),
+                boost::make_iterator_range(bias->begin(), bias->end())
             };
-            
+
             return std::move(params);
         }
+
+        void visit(parameter_visitor &visitor) {
+            visitor(kernel);
+            visitor(bias);
+        }
     };
 
+    /*!
+     Each sample is lowered to a patch matrix (im2col) and convolved with
+     every filter at once by a single matrix product.
+     */
     struct Convolve2DTransform {
-        void operator()(Convolve2DParams &params, const matrix_t &input, matrix_t &output) {
-            convolve2d(input, *params.kernel, output);
-        }
+        matrix_t patches;
+
+        void operator()(Convolve2DParams &params, const matrix_t &input, matrix_t &output);
     };
 
     struct Convolve2DGradient {
-        void operator ()(Convolve2DParams &params, Convolve2DGradParams &gparams, const matrix_t &input, const matrix_t &grad_output, matrix_t &grad_input) {
-            //            *gparams.weight += input*grad_output.t();
-            //            *gparams.bias += grad_output;
-            //            grad_input += *(params.weight)*grad_output;
-            
-            //            gparams.kernel +=
-            //            convolve2d(input, (*params.kernel).t(), grad_input);
-        }
+        matrix_t patches;
+        matrix_t grad_patches;
+
+        void operator ()(Convolve2DParams &params, Convolve2DGradParams &gparams, const matrix_t &input, const matrix_t &grad_output, matrix_t &grad_input);
+    };
+
+    /*!
+     Convolve2DModule convolves a batch of multi-channel images with a bank
+     of filters.
+
+     \code
+     // 3 channel 32x32 images, 16 filters of size 5x5
+     Convolve2DModule conv(Convolve2DGeometry(size(3, 32, 32), size(16, 5, 5), 1, 2));
+
+     matrix_t images(3*32*32, batch_size);
+     auto features = conv.forward(images);
+
+     std::cout << features.n_rows << std::endl;
+     // 16384 (16 filters x 32 x 32)
+     */
+    class Convolve2DModule: public ParameterizedModule<Convolve2DTransform, Convolve2DParams, Convolve2DGradient, Convolve2DGradParams> {
+    public:
+        Convolve2DModule(const Convolve2DGeometry &geometry);
+
+        const Convolve2DGeometry &get_geometry() const { return params.geometry; }
     };
 }
 
@@ -19,18 +19,22 @@ using namespace arma;
 namespace gnol {
     class Criterion {
     public:
-        virtual real_t forward(const vector_t &input, const vector_t &target) = 0;
-        virtual matrix_t &backward(const vector_t &input, const vector_t &target) = 0;
+        virtual real_t forward(const matrix_t &input, const matrix_t &target) = 0;
+        virtual matrix_t &backward(const matrix_t &input, const matrix_t &target) = 0;
     };
     
+    /*!
+     The loss of a batch (one sample per column) is the sum of the loss of
+     each sample.
+     */
     struct L2Op {
-        real_t operator ()(const vector_t &input, const vector_t &target) {
-            return 0.5*sum(pow(input - target, 2));
+        real_t operator ()(const matrix_t &input, const matrix_t &target) {
+            return 0.5*accu(square(input - target));
         }
     };
     
     struct L2Gradient {
-        vector_t operator ()(const vector_t &input, const vector_t &target) {
+        matrix_t operator ()(const matrix_t &input, const matrix_t &target) {
             return input - target;
         }
     };
@@ -39,15 +43,15 @@ namespace gnol {
     private:
         L2Op op;
         L2Gradient grad;
-        vector_t grad_input;
+        matrix_t grad_input;
     public:
-        real_t forward(const vector_t &input, const vector_t &target) {
+        real_t forward(const matrix_t &input, const matrix_t &target) {
 //            auto result = 0.5*sum(pow(input - target, 2));
 //            return std::move(result);
             return op(input, target);
         }
         
-        matrix_t &backward(const vector_t &input, const vector_t &target) {
+        matrix_t &backward(const matrix_t &input, const matrix_t &target) {
 //            grad_input = (input - target);
 //            return grad_input;
             grad_input = grad(input, target);
@@ -70,6 +74,8 @@ namespace gnol {
             GradientModule(target->n_rows, target->n_rows),
             target(target) {}
         
+        variable<matrix_t> &get_target() { return target; }
+        
         matrix_t &forward(const matrix_t &input) {
             *output = op(input, *target);
             return *output;
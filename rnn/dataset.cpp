@@ -0,0 +1,419 @@
+//
+//  dataset.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/16/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "dataset.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace gnol {
+    namespace {
+        struct header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t value_size;
+            std::uint64_t input_rows;
+            std::uint64_t target_rows;
+            std::uint64_t count;
+            std::uint64_t offset;
+        };
+
+        std::size_t data_offset() {
+            const std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+            return (sizeof(header) + page - 1)/page*page;
+        }
+
+        // points m at memory without copying or owning it
+        void bind_view(matrix_t &m, real_t *memory, std::size_t rows, std::size_t cols) {
+            m.~matrix_t();
+            new (&m) matrix_t(memory, rows, cols, false, true);
+        }
+    }
+
+    dataset_writer::dataset_writer(const std::string &path, std::size_t input_rows, std::size_t target_rows):
+        os(path, std::ios::binary | std::ios::trunc),
+        input_rows(input_rows),
+        target_rows(target_rows),
+        count(0)
+    {
+        if (!os)
+            throw std::runtime_error("dataset_writer: can't open " + path);
+
+        // the header is written for real by close(), once the number of
+        // samples is known
+        std::fill_n(std::ostreambuf_iterator<char>(os), data_offset(), '\0');
+    }
+
+    dataset_writer::~dataset_writer() {
+        try {
+            close();
+        } catch (...) {}
+    }
+
+    void dataset_writer::append(const matrix_t &input, const matrix_t &target) {
+        if (!os.is_open())
+            throw std::logic_error("dataset_writer: already closed");
+
+        if (input.n_rows != input_rows || target.n_rows != target_rows || input.n_cols != target.n_cols)
+            throw std::invalid_argument("dataset_writer: samples don't match the dataset");
+
+        for (std::size_t i = 0; i < input.n_cols; i++) {
+            os.write(reinterpret_cast<const char *>(input.colptr(i)), input_rows*sizeof(real_t));
+            os.write(reinterpret_cast<const char *>(target.colptr(i)), target_rows*sizeof(real_t));
+        }
+
+        count += input.n_cols;
+    }
+
+    void dataset_writer::close() {
+        if (!os.is_open())
+            return;
+
+        header head;
+        std::memcpy(head.magic, dataset_format::magic, sizeof(head.magic));
+        head.version = dataset_format::version;
+        head.value_size = sizeof(real_t);
+        head.input_rows = input_rows;
+        head.target_rows = target_rows;
+        head.count = count;
+        head.offset = data_offset();
+
+        os.seekp(0);
+        os.write(reinterpret_cast<const char *>(&head), sizeof(head));
+        os.close();
+
+        if (!os)
+            throw std::runtime_error("dataset_writer: failed writing");
+    }
+
+    dataset::dataset(const std::string &path):
+        memory(nullptr),
+        length(0)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("dataset: can't open " + path);
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || std::size_t(info.st_size) < sizeof(header)) {
+            ::close(fd);
+            throw std::runtime_error("dataset: can't read " + path);
+        }
+
+        length = std::size_t(info.st_size);
+        memory = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (memory == MAP_FAILED)
+            throw std::runtime_error("dataset: can't map " + path);
+
+        header head;
+        std::memcpy(&head, memory, sizeof(head));
+
+        input_rows = head.input_rows;
+        target_rows = head.target_rows;
+        count = head.count;
+        records = reinterpret_cast<const real_t *>(static_cast<const char *>(memory) + head.offset);
+
+        const bool valid =
+            std::memcmp(head.magic, dataset_format::magic, sizeof(head.magic)) == 0 &&
+            head.version == dataset_format::version &&
+            head.value_size == sizeof(real_t) &&
+            head.offset % sizeof(real_t) == 0 && head.offset <= length &&
+            count*record_size() <= (length - head.offset)/sizeof(real_t);
+
+        if (!valid) {
+            munmap(memory, length);
+            throw std::runtime_error("dataset: " + path + " is not a dataset or is truncated");
+        }
+    }
+
+    dataset::~dataset() {
+        munmap(memory, length);
+    }
+
+    void dataset::advise_sequential() const {
+        madvise(memory, length, MADV_SEQUENTIAL);
+    }
+
+    void dataset::advise_random() const {
+        madvise(memory, length, MADV_RANDOM);
+    }
+
+    void dataset::will_need(std::size_t first, std::size_t n) const {
+        advise(first, n, MADV_WILLNEED);
+    }
+
+    void dataset::dont_need(std::size_t first, std::size_t n) const {
+        advise(first, n, MADV_DONTNEED);
+    }
+
+    void dataset::advise(std::size_t first, std::size_t n, int advice) const {
+        const std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+        char *base = static_cast<char *>(memory);
+
+        // whole pages covering the records
+        const std::size_t begin = std::size_t(reinterpret_cast<const char *>(record(first)) - base)/page*page;
+        const std::size_t end = std::min(length,
+            (std::size_t(reinterpret_cast<const char *>(record(first + n)) - base) + page - 1)/page*page);
+
+        if (end > begin)
+            madvise(base + begin, end - begin, advice);
+    }
+
+    DatasetLoader::DatasetLoader(std::shared_ptr<dataset> data,
+                                 std::size_t batch_size,
+                                 bool shuffle,
+                                 std::size_t buffers,
+                                 unsigned seed):
+        data(data),
+        batch_size(batch_size),
+        shuffle(shuffle),
+        generator(seed),
+        block_size(0),
+        window(0),
+        slots(buffers)
+    {
+        if (shuffle)
+            data->advise_random();
+        else
+            data->advise_sequential();
+
+        start();
+    }
+
+    DatasetLoader::DatasetLoader(std::shared_ptr<dataset> data,
+                                 std::size_t batch_size,
+                                 block_shuffle order,
+                                 std::size_t buffers,
+                                 unsigned seed):
+        data(data),
+        batch_size(batch_size),
+        shuffle(true),
+        generator(seed),
+        block_size(order.block_size),
+        window(order.window),
+        slots(buffers)
+    {
+        if (block_size == 0 || window == 0)
+            throw std::invalid_argument("DatasetLoader: blocks and windows have to be positive");
+
+        // blocks are read front to back, so aggressive readahead pays off
+        data->advise_sequential();
+
+        start();
+    }
+
+    void DatasetLoader::start() {
+        if (batch_size == 0 || slots.empty())
+            throw std::invalid_argument("DatasetLoader: batch size and number of buffers have to be positive");
+
+        for (auto &s : slots) {
+            s.memory = allocate_aligned(data->record_size()*batch_size);
+            s.end_of_epoch = false;
+        }
+
+        head = tail = ready = 0;
+        holding = stopping = false;
+        next_block = current_block = current_blocks = 0;
+
+        producer = std::thread(&DatasetLoader::run, this);
+    }
+
+    DatasetLoader::~DatasetLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        released.notify_all();
+        producer.join();
+    }
+
+    const minibatch *DatasetLoader::next() {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // the batch handed out last goes back to the producer
+        if (holding) {
+            holding = false;
+            released.notify_one();
+        }
+
+        filled.wait(lock, [this]() { return ready > 0 || error; });
+        if (ready == 0)
+            std::rethrow_exception(error);
+
+        slot &s = slots[head];
+        head = (head + 1) % slots.size();
+        ready--;
+
+        if (s.end_of_epoch) {
+            released.notify_one();
+            return nullptr;
+        }
+
+        holding = true;
+        return &s.batch;
+    }
+
+    void DatasetLoader::start_epoch() {
+        next_block = current_block = current_blocks = 0;
+
+        if (block_size == 0)
+            return;
+
+        blocks.resize((data->size() + block_size - 1)/block_size);
+        std::iota(blocks.begin(), blocks.end(), 0);
+        std::shuffle(blocks.begin(), blocks.end(), generator);
+
+        for (std::size_t i = 0; i < std::min(window, blocks.size()); i++)
+            data->will_need(blocks[i]*block_size, std::min(block_size, data->size() - blocks[i]*block_size));
+    }
+
+    bool DatasetLoader::next_window(std::vector<std::size_t> &indices) {
+        const std::size_t first = indices.size();
+        const std::size_t count = data->size();
+
+        // everything at once
+        if (block_size == 0) {
+            if (next_block > 0)
+                return false;
+
+            next_block = 1;
+            indices.resize(first + count);
+            std::iota(indices.begin() + first, indices.end(), 0);
+
+            if (shuffle)
+                std::shuffle(indices.begin() + first, indices.end(), generator);
+            return true;
+        }
+
+        // the window just used can go (the few samples of it not yet in
+        // a batch are read back if needed)
+        for (std::size_t i = current_block; i < current_block + current_blocks; i++)
+            data->dont_need(blocks[i]*block_size, std::min(block_size, count - blocks[i]*block_size));
+
+        if (next_block >= blocks.size()) {
+            current_blocks = 0;
+            return false;
+        }
+
+        current_block = next_block;
+        current_blocks = std::min(window, blocks.size() - next_block);
+        next_block += current_blocks;
+
+        // the following window is read ahead while this one is used
+        for (std::size_t i = next_block; i < std::min(next_block + window, blocks.size()); i++)
+            data->will_need(blocks[i]*block_size, std::min(block_size, count - blocks[i]*block_size));
+
+        for (std::size_t i = current_block; i < next_block; i++) {
+            const std::size_t begin = blocks[i]*block_size;
+            const std::size_t end = std::min(begin + block_size, count);
+
+            for (std::size_t j = begin; j < end; j++)
+                indices.push_back(j);
+        }
+
+        std::shuffle(indices.begin() + first, indices.end(), generator);
+        return true;
+    }
+
+    bool DatasetLoader::acquire(std::size_t &index) {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [this]() {
+            return stopping || ready + (holding ? 1 : 0) < slots.size();
+        });
+
+        index = tail;
+        return !stopping;
+    }
+
+    void DatasetLoader::publish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tail = (tail + 1) % slots.size();
+            ready++;
+        }
+
+        filled.notify_one();
+    }
+
+    void DatasetLoader::fill(slot &s, const std::size_t *indices, std::size_t n, std::size_t epoch) {
+        const std::size_t input_rows = data->get_input_rows();
+        const std::size_t target_rows = data->get_target_rows();
+
+        real_t *inputs = s.memory.get();
+        real_t *targets = inputs + input_rows*batch_size;
+
+        for (std::size_t k = 0; k < n; k++) {
+            const real_t *record = data->record(indices[k]);
+            std::copy(record, record + input_rows, inputs + k*input_rows);
+            std::copy(record + input_rows, record + input_rows + target_rows, targets + k*target_rows);
+        }
+
+        bind_view(s.batch.input, inputs, input_rows, n);
+        bind_view(s.batch.target, targets, target_rows, n);
+        s.batch.epoch = epoch;
+        s.end_of_epoch = false;
+    }
+
+    bool DatasetLoader::emit(const std::size_t *indices, std::size_t n, std::size_t epoch) {
+        std::size_t index;
+        if (!acquire(index))
+            return false;
+
+        fill(slots[index], indices, n, epoch);
+        publish();
+        return true;
+    }
+
+    void DatasetLoader::run() {
+        try {
+            std::vector<std::size_t> indices;
+
+            for (std::size_t epoch = 0;; epoch++) {
+                start_epoch();
+                indices.clear();
+
+                while (next_window(indices)) {
+                    std::size_t pos = 0;
+                    for (; indices.size() - pos >= batch_size; pos += batch_size) {
+                        if (!emit(indices.data() + pos, batch_size, epoch))
+                            return;
+                    }
+
+                    // the rest is mixed into the next window
+                    indices.erase(indices.begin(), indices.begin() + pos);
+                }
+
+                if (!indices.empty() && !emit(indices.data(), indices.size(), epoch))
+                    return;
+
+                std::size_t index;
+                if (!acquire(index))
+                    return;
+
+                slots[index].end_of_epoch = true;
+                publish();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+            filled.notify_all();
+        }
+    }
+}
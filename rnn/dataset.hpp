@@ -0,0 +1,221 @@
+//
+//  dataset.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/16/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef dataset_hpp
+#define dataset_hpp
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utility.hpp"
+
+namespace gnol {
+    namespace dataset_format {
+        const char magic[8] = {'G', 'N', 'O', 'L', 'D', 'A', 'T', '\0'};
+        const std::uint32_t version = 1;
+    }
+
+    /*!
+     Writes a dataset file: a header followed, from the first page
+     boundary on, by one record per sample holding its input and then its
+     target. Samples are appended a batch (one per column) at a time, so
+     the dataset never has to be in memory as a whole.
+     */
+    class dataset_writer {
+        std::ofstream os;
+        std::size_t input_rows, target_rows;
+        std::size_t count;
+    public:
+        dataset_writer(const std::string &path, std::size_t input_rows, std::size_t target_rows);
+        ~dataset_writer();
+
+        void append(const matrix_t &input, const matrix_t &target);
+        std::size_t size() const { return count; }
+
+        // writes the final header; called by the destructor if needed
+        void close();
+    };
+
+    /*!
+     A dataset file mapped (read only) into memory. Records are read
+     straight from the mapping, so opening the file costs nothing however
+     large it is.
+     */
+    class dataset {
+        void *memory;
+        std::size_t length;
+        const real_t *records;
+        std::size_t input_rows, target_rows;
+        std::size_t count;
+    public:
+        explicit dataset(const std::string &path);
+        ~dataset();
+
+        dataset(const dataset &) = delete;
+        dataset &operator =(const dataset &) = delete;
+
+        std::size_t size() const { return count; }
+        std::size_t get_input_rows() const { return input_rows; }
+        std::size_t get_target_rows() const { return target_rows; }
+        std::size_t record_size() const { return input_rows + target_rows; }
+
+        // the input of sample index, followed by its target
+        const real_t *record(std::size_t index) const { return records + index*record_size(); }
+
+        // hints how the records are going to be read
+        void advise_sequential() const;
+        void advise_random() const;
+
+        // hints that records [first, first + n) will be read soon, or
+        // won't be for a while (so their pages can be dropped)
+        void will_need(std::size_t first, std::size_t n) const;
+        void dont_need(std::size_t first, std::size_t n) const;
+    protected:
+        void advise(std::size_t first, std::size_t n, int advice) const;
+    };
+
+    /*!
+     A minibatch, one sample per column. The matrices are views of a
+     buffer owned by the loader.
+     */
+    struct minibatch {
+        matrix_t input, target;
+        std::size_t epoch;
+    };
+
+    /*!
+     Visiting order for datasets larger than memory. The samples are cut
+     into blocks of block_size consecutive samples, which are visited in
+     a random order, window blocks at a time; the samples of a window are
+     shuffled together. Every read is then a long sequential run, while
+     each batch still mixes samples from window distant parts of the
+     dataset.
+     */
+    struct block_shuffle {
+        std::size_t block_size;
+        std::size_t window;
+
+        block_shuffle(std::size_t block_size, std::size_t window=8):
+            block_size(block_size), window(window) {}
+    };
+
+    /*!
+     DatasetLoader assembles minibatches on a background thread into a
+     ring of preallocated buffers (two by default, i.e. double
+     buffering), while the caller trains on the one it was handed last,
+     so reading and gathering samples overlaps with compute. Batches are
+     handed over as views, without copying.
+
+     Every epoch visits each sample once, in a new random order if
+     shuffling. The last batch of an epoch can be smaller than the rest.
+
+     With a block_shuffle the dataset is streamed instead: the next window
+     of blocks is read ahead while the current one is used, and the pages
+     of a window are dropped once it has been used, so only about two
+     windows are ever resident and a dataset many times the size of
+     memory trains at sequential read speed. The batches come out the
+     same way as for one that fits in memory.
+
+     \code
+     auto data = std::make_shared<dataset>("train.gnol");
+     DatasetLoader loader(data, 128);
+
+     for (std::size_t epoch = 0; epoch < 10; epoch++) {
+        while (auto batch = loader.next())
+           trainer.train(batch->input, batch->target, 0.01);
+     }
+
+     // 64k samples per block, 16 blocks shuffled together
+     DatasetLoader streamed(data, 128, block_shuffle(1 << 16, 16));
+     */
+    class DatasetLoader {
+    protected:
+        struct slot {
+            std::shared_ptr<real_t> memory;
+            minibatch batch;
+            bool end_of_epoch;
+        };
+
+        std::shared_ptr<dataset> data;
+        std::size_t batch_size;
+        bool shuffle;
+        std::mt19937 generator;
+
+        // 0 unless streaming blocks
+        std::size_t block_size, window;
+        std::vector<std::size_t> blocks;
+        std::size_t next_block, current_block, current_blocks;
+
+        std::vector<slot> slots;
+
+        // slots are filled and handed out in ring order; the caller
+        // holds at most one (the one before head) at a time
+        std::size_t head, tail, ready;
+        bool holding;
+        bool stopping;
+        std::exception_ptr error;
+
+        std::mutex mutex;
+        std::condition_variable filled, released;
+        std::thread producer;
+    public:
+        DatasetLoader(std::shared_ptr<dataset> data,
+                      std::size_t batch_size,
+                      bool shuffle=true,
+                      std::size_t buffers=2,
+                      unsigned seed=0);
+
+        DatasetLoader(std::shared_ptr<dataset> data,
+                      std::size_t batch_size,
+                      block_shuffle order,
+                      std::size_t buffers=2,
+                      unsigned seed=0);
+        ~DatasetLoader();
+
+        DatasetLoader(const DatasetLoader &) = delete;
+        DatasetLoader &operator =(const DatasetLoader &) = delete;
+
+        std::size_t get_batch_size() const { return batch_size; }
+
+        /*!
+         Waits for the next minibatch, which stays valid until the next
+         call. Returns nullptr at the end of each epoch; the call after
+         that starts on the next one (which is already being prefetched).
+         Rethrows anything that went wrong while reading.
+         */
+        const minibatch *next();
+    protected:
+        void start();
+        void run();
+
+        // plans the order of the next epoch
+        void start_epoch();
+
+        // appends the samples of the next part of the epoch to indices,
+        // returning false once the epoch is over
+        bool next_window(std::vector<std::size_t> &indices);
+
+        // hands out the samples as a batch, returning false when stopping
+        bool emit(const std::size_t *indices, std::size_t n, std::size_t epoch);
+
+        // waits for a free slot, returning false when stopping
+        bool acquire(std::size_t &index);
+        void publish();
+        void fill(slot &s, const std::size_t *indices, std::size_t n, std::size_t epoch);
+    };
+}
+
+#endif /* dataset_hpp */
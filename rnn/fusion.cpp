@@ -0,0 +1,99 @@
+//
+//  fusion.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/17/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "fusion.hpp"
+
+namespace gnol {
+    namespace {
+        typedef SequenceModule::ptr_t ptr_t;
+
+        template <typename OpT, typename GradOpT>
+        ptr_t fuse_linear(GradientModule &linear, GradientModule &activation) {
+            if (!dynamic_cast<ActivationModule<OpT, GradOpT> *>(&activation))
+                return nullptr;
+
+            if (auto l = dynamic_cast<LinearModule *>(&linear))
+                return std::make_shared<FusedLinearModule<LinearProduct, OpT, GradOpT>>(*l);
+
+            if (auto t = dynamic_cast<TransposedLinearModule *>(&linear))
+                return std::make_shared<FusedLinearModule<TransposedLinearProduct, OpT, GradOpT>>(*t);
+
+            return nullptr;
+        }
+
+        template <typename OpT, typename GradOpT>
+        ptr_t fuse_l2(GradientModule &activation, GradientModule &criterion) {
+            if (!dynamic_cast<ActivationModule<OpT, GradOpT> *>(&activation))
+                return nullptr;
+
+            if (auto c = dynamic_cast<CriterionModule<L2Op, L2Gradient> *>(&criterion))
+                return std::make_shared<FusedL2Module<OpT, GradOpT>>(*c);
+
+            return nullptr;
+        }
+
+        ptr_t fuse_linear(GradientModule &linear, GradientModule &activation) {
+            ptr_t fused;
+            if ((fused = fuse_linear<SigmoidOp, SigmoidGradient>(linear, activation)) ||
+                (fused = fuse_linear<TanhOp, TanhGradient>(linear, activation)) ||
+                (fused = fuse_linear<ReLUOp, ReLUGradient>(linear, activation)) ||
+                (fused = fuse_linear<SoftplusOp, SoftplusGradient>(linear, activation)))
+            {
+                return fused;
+            }
+
+            return nullptr;
+        }
+
+        ptr_t fuse_l2(GradientModule &activation, GradientModule &criterion) {
+            ptr_t fused;
+            if ((fused = fuse_l2<SigmoidOp, SigmoidGradient>(activation, criterion)) ||
+                (fused = fuse_l2<TanhOp, TanhGradient>(activation, criterion)) ||
+                (fused = fuse_l2<ReLUOp, ReLUGradient>(activation, criterion)) ||
+                (fused = fuse_l2<SoftplusOp, SoftplusGradient>(activation, criterion)))
+            {
+                return fused;
+            }
+
+            return nullptr;
+        }
+    }
+
+    std::size_t fuse_modules(SequenceModule &seq) {
+        std::size_t fusions = 0;
+
+        for (std::size_t i = 0; i < seq.size(); i++) {
+            if (auto nested = dynamic_cast<SequenceModule *>(seq[i].get()))
+                fusions += fuse_modules(*nested);
+        }
+
+        for (std::size_t i = 0; i + 1 < seq.size(); i++) {
+            ptr_t fused;
+            std::size_t at = i;
+
+            // an activation feeding the criterion goes with the criterion
+            if (i + 2 < seq.size() && (fused = fuse_l2(*seq[i + 1], *seq[i + 2])))
+                at = i + 1;
+            else if (!(fused = fuse_linear(*seq[i], *seq[i + 1])))
+                fused = fuse_l2(*seq[i], *seq[i + 1]);
+
+            if (!fused)
+                continue;
+
+            // what was only there for inference stays that way
+            if (seq[at]->is_frozen() || seq[at + 1]->is_frozen())
+                fused->freeze();
+
+            seq.replace(at, 2, fused);
+            fusions++;
+            i = at;
+        }
+
+        return fusions;
+    }
+}
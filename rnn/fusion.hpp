@@ -0,0 +1,233 @@
+//
+//  fusion.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/17/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef fusion_hpp
+#define fusion_hpp
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "module.hpp"
+#include "linear.hpp"
+#include "activation.hpp"
+#include "criterion.hpp"
+#include "sequence.hpp"
+
+namespace gnol {
+    // the matrix products of LinearModule (weight is input x output) and
+    // TransposedLinearModule (weight is output x input)
+    struct LinearProduct {
+        void operator ()(const matrix_t &weight, const matrix_t &input, matrix_t &output) {
+            output = weight.t()*input;
+        }
+
+        void backward(const matrix_t &weight, matrix_t &grad_weight, const matrix_t &input,
+                      const matrix_t &grad, matrix_t &grad_input)
+        {
+            grad_weight += input*grad.t();
+            grad_input += weight*grad;
+        }
+    };
+
+    struct TransposedLinearProduct {
+        void operator ()(const matrix_t &weight, const matrix_t &input, matrix_t &output) {
+            output = weight*input;
+        }
+
+        void backward(const matrix_t &weight, matrix_t &grad_weight, const matrix_t &input,
+                      const matrix_t &grad, matrix_t &grad_input)
+        {
+            grad_weight += grad*input.t();
+            grad_input += weight.t()*grad;
+        }
+    };
+
+    /*!
+     A linear layer and the activation after it as one module. Forward
+     adds the bias and applies the activation a column at a time, right
+     after the product and while the column is still in cache, rather
+     than in two more passes over the output. Backward likewise turns the
+     gradient of the output into that of the preactivation and sums it
+     into the bias gradient in a single pass, before the two products.
+
+     The parameters and gradients are those of the linear module it
+     replaces (shared, not copied).
+     */
+    template <typename ProductT, typename OpT, typename GradOpT>
+    class FusedLinearModule: public GradientModule {
+    protected:
+        ProductT product;
+        OpT op;
+        GradOpT grad;
+
+        LinearParams params;
+        LinearGradParams grad_params;
+
+        // gradient of the preactivation
+        matrix_t grad_pre;
+    public:
+        template <typename LinearT>
+        FusedLinearModule(LinearT &linear):
+            GradientModule(linear.get_input_size(), linear.get_output_size()),
+            params(std::move(linear.get_params())),
+            grad_params(linear.get_grad_params()) {}
+
+        LinearParams &get_params() { return params; }
+        LinearGradParams &get_grad_params() { return grad_params; }
+
+        matrix_t &forward(const matrix_t &input) {
+            product(*params.weight, input, *output);
+
+            const real_t *bias = params.bias->memptr();
+            const std::size_t rows = output->n_rows;
+
+            for (uword j = 0; j < output->n_cols; j++) {
+                real_t *column = output->colptr(j);
+                for (std::size_t i = 0; i < rows; i++)
+                    column[i] += bias[i];
+
+                op(column, column, rows);
+            }
+
+            return *output;
+        }
+
+        matrix_t &backward(const matrix_t &input, const matrix_t &grad_output) {
+            match_grad_input(input);
+
+            const std::size_t rows = output->n_rows;
+            grad_pre.set_size(rows, output->n_cols);
+            real_t *grad_bias = grad_params.bias->memptr();
+
+            for (uword j = 0; j < grad_pre.n_cols; j++) {
+                real_t *column = grad_pre.colptr(j);
+                std::fill(column, column + rows, 0);
+                grad(output->colptr(j), grad_output.colptr(j), column, rows);
+
+                for (std::size_t i = 0; i < rows; i++)
+                    grad_bias[i] += column[i];
+            }
+
+            product.backward(*params.weight, *grad_params.weight, input, grad_pre, grad_input);
+            return grad_input;
+        }
+
+        bool backward_uses_output() const { return true; }
+
+        void clear() {
+            grad_input.zeros();
+            grad_params.clear();
+        }
+
+        parameter_list flatten_parameters() { return params.flatten(); }
+        parameter_list flatten_deriv_parameters() { return grad_params.flatten(); }
+
+        void visit_parameters(parameter_visitor &visitor) { params.visit(visitor); }
+        void visit_deriv_parameters(parameter_visitor &visitor) { grad_params.visit(visitor); }
+    };
+
+    /*!
+     An activation followed by CriterionModule<L2Op, L2Gradient> as one
+     module. Forward applies the activation and sums the loss a column at
+     a time; backward goes straight from the activations and the target
+     to the gradient of the preactivation, without the gradient of the
+     activations ever being stored. The target is the one of the
+     criterion it replaces.
+     */
+    template <typename OpT, typename GradOpT>
+    class FusedL2Module: public GradientModule {
+    protected:
+        OpT op;
+        GradOpT grad;
+        variable<matrix_t> target;
+
+        // kept for backward
+        matrix_t activation;
+        vector_t difference;
+    public:
+        FusedL2Module(CriterionModule<L2Op, L2Gradient> &criterion):
+            GradientModule(criterion.get_input_size(), criterion.get_output_size()),
+            target(criterion.get_target()) {}
+
+        matrix_t &forward(const matrix_t &input) {
+            check(input);
+
+            const std::size_t rows = input.n_rows;
+            activation.set_size(rows, input.n_cols);
+
+            real_t loss = 0;
+            for (uword j = 0; j < input.n_cols; j++) {
+                real_t *a = activation.colptr(j);
+                const real_t *t = target->colptr(j);
+                op(input.colptr(j), a, rows);
+
+                for (std::size_t i = 0; i < rows; i++)
+                    loss += (a[i] - t[i])*(a[i] - t[i]);
+            }
+
+            *output = 0.5*loss;
+            return *output;
+        }
+
+        // like the criterion, ignores grad_output and overwrites the
+        // gradient
+        matrix_t &backward(const matrix_t &input, const matrix_t &grad_output) {
+            check(input);
+            match_grad_input(input);
+
+            const std::size_t rows = input.n_rows;
+            difference.set_size(rows);
+
+            for (uword j = 0; j < input.n_cols; j++) {
+                const real_t *a = activation.colptr(j);
+                const real_t *t = target->colptr(j);
+                for (std::size_t i = 0; i < rows; i++)
+                    difference[i] = a[i] - t[i];
+
+                real_t *column = grad_input.colptr(j);
+                std::fill(column, column + rows, 0);
+                grad(a, difference.memptr(), column, rows);
+            }
+
+            return grad_input;
+        }
+
+        bool backward_uses_input() const { return false; }
+
+        parameter_list flatten_parameters() { return empty_parameter_list; }
+        parameter_list flatten_deriv_parameters() { return empty_parameter_list; }
+    protected:
+        // the target is read column by column, so it has to match exactly
+        void check(const matrix_t &input) {
+            if (target->n_rows != input.n_rows || target->n_cols != input.n_cols)
+                throw std::invalid_argument("FusedL2Module: target doesn't match the input");
+        }
+    };
+
+    /*!
+     Rewrites seq (and any sequence nested in it) in place, replacing
+     each LinearModule or TransposedLinearModule followed by an
+     activation with a FusedLinearModule, and each activation followed by
+     an L2 CriterionModule with a FusedL2Module. An activation followed
+     by the criterion is fused with the criterion. A fused module takes
+     over the name of the last module it replaces. The result computes
+     the same values with the same parameters. Returns the number of
+     fusions made.
+
+     Modules outside of seq that hold on to a replaced module (e.g. by
+     name, from before the rewrite) keep the original, which still works
+     but isn't part of seq any more.
+
+     \code
+     auto ae = make_autoencoder(weight, grad_weight);
+     fuse_modules(*ae);
+     */
+    std::size_t fuse_modules(SequenceModule &seq);
+}
+
+#endif /* fusion_hpp */
@@ -0,0 +1,499 @@
+//
+//  kernels.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/6/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GNOL_X86_KERNELS 1
+#include <immintrin.h>
+#define GNOL_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define GNOL_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace gnol {
+    namespace kernels {
+        namespace {
+            // beyond these exp() overflows or becomes denormal
+            const real_t exp_min = -708.0;
+            const real_t exp_max = 709.0;
+
+            const real_t log2e = 1.4426950408889634074;
+
+            // ln(2) split so that n*ln2_hi is exact for the n we use
+            const real_t ln2_hi = 6.93145751953125e-1;
+            const real_t ln2_lo = 1.42860682030941723212e-6;
+
+            // Taylor series of exp(r) for |r| <= ln(2)/2, highest order
+            // first; the truncation error is below 2e-16
+            const real_t exp_coeffs[] = {
+                1.0/479001600.0, 1.0/39916800.0, 1.0/3628800.0, 1.0/362880.0,
+                1.0/40320.0, 1.0/5040.0, 1.0/720.0, 1.0/120.0, 1.0/24.0,
+                1.0/6.0, 1.0/2.0, 1.0, 1.0
+            };
+            const std::size_t exp_terms = sizeof(exp_coeffs)/sizeof(real_t);
+
+            // below this tanh(x) = (1 - e)/(1 + e) loses precision to
+            // cancellation, so its Taylor series is used instead
+            const real_t tanh_small = 0.0625;
+            const real_t tanh_coeffs[] = {
+                62.0/2835.0, -17.0/315.0, 2.0/15.0, -1.0/3.0, 1.0
+            };
+            const std::size_t tanh_terms = sizeof(tanh_coeffs)/sizeof(real_t);
+
+            inline real_t exp_scalar(real_t x) {
+                x = std::min(std::max(x, exp_min), exp_max);
+
+                // x = n*ln(2) + r
+                const real_t n = std::nearbyint(x*log2e);
+                const real_t r = (x - n*ln2_hi) - n*ln2_lo;
+
+                real_t p = exp_coeffs[0];
+                for (std::size_t i = 1; i < exp_terms; i++)
+                    p = p*r + exp_coeffs[i];
+
+                // 2^n built directly from its exponent bits
+                const std::int64_t bits = (std::int64_t(n) + 1023) << 52;
+                real_t scale;
+                std::memcpy(&scale, &bits, sizeof(scale));
+
+                return p*scale;
+            }
+
+            inline real_t tanh_scalar(real_t x) {
+                const real_t a = std::fabs(x);
+
+                if (a < tanh_small) {
+                    const real_t x2 = x*x;
+                    real_t p = tanh_coeffs[0];
+                    for (std::size_t i = 1; i < tanh_terms; i++)
+                        p = p*x2 + tanh_coeffs[i];
+                    return x*p;
+                }
+
+                const real_t e = exp_scalar(-2*a);
+                return std::copysign((1 - e)/(1 + e), x);
+            }
+
+            void exp_generic(const real_t *input, real_t *output, std::size_t n) {
+                for (std::size_t i = 0; i < n; i++)
+                    output[i] = exp_scalar(input[i]);
+            }
+
+            void sigmoid_generic(const real_t *input, real_t *output, std::size_t n) {
+                for (std::size_t i = 0; i < n; i++)
+                    output[i] = 1/(1 + exp_scalar(-input[i]));
+            }
+
+            void tanh_generic(const real_t *input, real_t *output, std::size_t n) {
+                for (std::size_t i = 0; i < n; i++)
+                    output[i] = tanh_scalar(input[i]);
+            }
+
+            void softplus_generic(const real_t *input, real_t *output, std::size_t n) {
+                // log(1 + exp(x)) rearranged so exp never overflows
+                for (std::size_t i = 0; i < n; i++) {
+                    const real_t x = input[i];
+                    output[i] = std::max(x, real_t(0)) + std::log1p(exp_scalar(-std::fabs(x)));
+                }
+            }
+
+            void softplus_backward_generic(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+                // sigmoid(x) = 1 - exp(-softplus(x))
+                for (std::size_t i = 0; i < n; i++)
+                    grad_input[i] += grad_output[i]*(1 - exp_scalar(-output[i]));
+            }
+
+#ifdef GNOL_X86_KERNELS
+            /*
+             AVX2 (4 doubles per register). The structure mirrors
+             exp_scalar; 2^n is built by adding a magic constant so the
+             integer n ends up in the low mantissa bits and shifting it
+             into the exponent field.
+             */
+            GNOL_TARGET_AVX2 inline __m256d exp_avx2(__m256d x) {
+                x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(exp_min)), _mm256_set1_pd(exp_max));
+
+                const __m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(log2e)),
+                                                  _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+                __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(ln2_hi), x);
+                r = _mm256_fnmadd_pd(n, _mm256_set1_pd(ln2_lo), r);
+
+                __m256d p = _mm256_set1_pd(exp_coeffs[0]);
+                for (std::size_t i = 1; i < exp_terms; i++)
+                    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(exp_coeffs[i]));
+
+                const __m256d biased = _mm256_add_pd(n, _mm256_set1_pd(4503599627370496.0 + 1023));
+                const __m256i bits = _mm256_slli_epi64(_mm256_castpd_si256(biased), 52);
+
+                return _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+            }
+
+            GNOL_TARGET_AVX2 void exp_avx2(const real_t *input, real_t *output, std::size_t n) {
+                std::size_t i = 0;
+                for (; i + 4 <= n; i += 4)
+                    _mm256_storeu_pd(output + i, exp_avx2(_mm256_loadu_pd(input + i)));
+                exp_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX2 void sigmoid_avx2(const real_t *input, real_t *output, std::size_t n) {
+                const __m256d one = _mm256_set1_pd(1);
+                const __m256d zero = _mm256_setzero_pd();
+
+                std::size_t i = 0;
+                for (; i + 4 <= n; i += 4) {
+                    const __m256d e = exp_avx2(_mm256_sub_pd(zero, _mm256_loadu_pd(input + i)));
+                    _mm256_storeu_pd(output + i, _mm256_div_pd(one, _mm256_add_pd(one, e)));
+                }
+                sigmoid_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX2 void tanh_avx2(const real_t *input, real_t *output, std::size_t n) {
+                const __m256d one = _mm256_set1_pd(1);
+                const __m256d sign = _mm256_set1_pd(-0.0);
+
+                std::size_t i = 0;
+                for (; i + 4 <= n; i += 4) {
+                    const __m256d x = _mm256_loadu_pd(input + i);
+                    const __m256d a = _mm256_andnot_pd(sign, x);
+
+                    const __m256d e = exp_avx2(_mm256_mul_pd(a, _mm256_set1_pd(-2)));
+                    __m256d t = _mm256_div_pd(_mm256_sub_pd(one, e), _mm256_add_pd(one, e));
+                    t = _mm256_or_pd(t, _mm256_and_pd(x, sign));
+
+                    const __m256d x2 = _mm256_mul_pd(x, x);
+                    __m256d p = _mm256_set1_pd(tanh_coeffs[0]);
+                    for (std::size_t j = 1; j < tanh_terms; j++)
+                        p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(tanh_coeffs[j]));
+                    p = _mm256_mul_pd(p, x);
+
+                    const __m256d small = _mm256_cmp_pd(a, _mm256_set1_pd(tanh_small), _CMP_LT_OQ);
+                    _mm256_storeu_pd(output + i, _mm256_blendv_pd(t, p, small));
+                }
+                tanh_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX2 void softplus_avx2(const real_t *input, real_t *output, std::size_t n) {
+                const __m256d sign = _mm256_set1_pd(-0.0);
+
+                std::size_t i = 0;
+                for (; i + 4 <= n; i += 4) {
+                    const __m256d x = _mm256_loadu_pd(input + i);
+
+                    // exp(-|x|) is vectorized, log1p is left to libm
+                    real_t e[4], positive[4];
+                    _mm256_storeu_pd(e, exp_avx2(_mm256_or_pd(x, sign)));
+                    _mm256_storeu_pd(positive, _mm256_max_pd(x, _mm256_setzero_pd()));
+
+                    for (std::size_t j = 0; j < 4; j++)
+                        output[i + j] = positive[j] + std::log1p(e[j]);
+                }
+                softplus_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX2 void softplus_backward_avx2(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+                const __m256d one = _mm256_set1_pd(1);
+                const __m256d zero = _mm256_setzero_pd();
+
+                std::size_t i = 0;
+                for (; i + 4 <= n; i += 4) {
+                    const __m256d e = exp_avx2(_mm256_sub_pd(zero, _mm256_loadu_pd(output + i)));
+                    const __m256d g = _mm256_mul_pd(_mm256_loadu_pd(grad_output + i), _mm256_sub_pd(one, e));
+                    _mm256_storeu_pd(grad_input + i, _mm256_add_pd(_mm256_loadu_pd(grad_input + i), g));
+                }
+                softplus_backward_generic(output + i, grad_output + i, grad_input + i, n - i);
+            }
+
+            /*
+             AVX-512 (8 doubles per register); same algorithms as AVX2.
+             AVX512F has no floating point bitwise ops, so sign
+             manipulation goes through the integer unit.
+             */
+            GNOL_TARGET_AVX512 inline __m512d exp_avx512(__m512d x) {
+                x = _mm512_min_pd(_mm512_max_pd(x, _mm512_set1_pd(exp_min)), _mm512_set1_pd(exp_max));
+
+                const __m512d n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(log2e)),
+                                                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+                __m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(ln2_hi), x);
+                r = _mm512_fnmadd_pd(n, _mm512_set1_pd(ln2_lo), r);
+
+                __m512d p = _mm512_set1_pd(exp_coeffs[0]);
+                for (std::size_t i = 1; i < exp_terms; i++)
+                    p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(exp_coeffs[i]));
+
+                const __m512d biased = _mm512_add_pd(n, _mm512_set1_pd(4503599627370496.0 + 1023));
+                const __m512i bits = _mm512_slli_epi64(_mm512_castpd_si512(biased), 52);
+
+                return _mm512_mul_pd(p, _mm512_castsi512_pd(bits));
+            }
+
+            GNOL_TARGET_AVX512 inline __m512d or_sign_avx512(__m512d x, __m512d sign_of) {
+                const __m512i sign = _mm512_set1_epi64(std::int64_t(1) << 63);
+                return _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(x),
+                    _mm512_and_si512(_mm512_castpd_si512(sign_of), sign)));
+            }
+
+            GNOL_TARGET_AVX512 void exp_avx512(const real_t *input, real_t *output, std::size_t n) {
+                std::size_t i = 0;
+                for (; i + 8 <= n; i += 8)
+                    _mm512_storeu_pd(output + i, exp_avx512(_mm512_loadu_pd(input + i)));
+                exp_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX512 void sigmoid_avx512(const real_t *input, real_t *output, std::size_t n) {
+                const __m512d one = _mm512_set1_pd(1);
+                const __m512d zero = _mm512_setzero_pd();
+
+                std::size_t i = 0;
+                for (; i + 8 <= n; i += 8) {
+                    const __m512d e = exp_avx512(_mm512_sub_pd(zero, _mm512_loadu_pd(input + i)));
+                    _mm512_storeu_pd(output + i, _mm512_div_pd(one, _mm512_add_pd(one, e)));
+                }
+                sigmoid_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX512 void tanh_avx512(const real_t *input, real_t *output, std::size_t n) {
+                const __m512d one = _mm512_set1_pd(1);
+
+                std::size_t i = 0;
+                for (; i + 8 <= n; i += 8) {
+                    const __m512d x = _mm512_loadu_pd(input + i);
+                    const __m512d a = _mm512_abs_pd(x);
+
+                    const __m512d e = exp_avx512(_mm512_mul_pd(a, _mm512_set1_pd(-2)));
+                    __m512d t = _mm512_div_pd(_mm512_sub_pd(one, e), _mm512_add_pd(one, e));
+                    t = or_sign_avx512(t, x);
+
+                    const __m512d x2 = _mm512_mul_pd(x, x);
+                    __m512d p = _mm512_set1_pd(tanh_coeffs[0]);
+                    for (std::size_t j = 1; j < tanh_terms; j++)
+                        p = _mm512_fmadd_pd(p, x2, _mm512_set1_pd(tanh_coeffs[j]));
+                    p = _mm512_mul_pd(p, x);
+
+                    const __mmask8 small = _mm512_cmp_pd_mask(a, _mm512_set1_pd(tanh_small), _CMP_LT_OQ);
+                    _mm512_storeu_pd(output + i, _mm512_mask_blend_pd(small, t, p));
+                }
+                tanh_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX512 void softplus_avx512(const real_t *input, real_t *output, std::size_t n) {
+                std::size_t i = 0;
+                for (; i + 8 <= n; i += 8) {
+                    const __m512d x = _mm512_loadu_pd(input + i);
+
+                    // exp(-|x|) is vectorized, log1p is left to libm
+                    real_t e[8], positive[8];
+                    _mm512_storeu_pd(e, exp_avx512(or_sign_avx512(x, _mm512_set1_pd(-1))));
+                    _mm512_storeu_pd(positive, _mm512_max_pd(x, _mm512_setzero_pd()));
+
+                    for (std::size_t j = 0; j < 8; j++)
+                        output[i + j] = positive[j] + std::log1p(e[j]);
+                }
+                softplus_generic(input + i, output + i, n - i);
+            }
+
+            GNOL_TARGET_AVX512 void softplus_backward_avx512(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+                const __m512d one = _mm512_set1_pd(1);
+                const __m512d zero = _mm512_setzero_pd();
+
+                std::size_t i = 0;
+                for (; i + 8 <= n; i += 8) {
+                    const __m512d e = exp_avx512(_mm512_sub_pd(zero, _mm512_loadu_pd(output + i)));
+                    const __m512d g = _mm512_mul_pd(_mm512_loadu_pd(grad_output + i), _mm512_sub_pd(one, e));
+                    _mm512_storeu_pd(grad_input + i, _mm512_add_pd(_mm512_loadu_pd(grad_input + i), g));
+                }
+                softplus_backward_generic(output + i, grad_output + i, grad_input + i, n - i);
+            }
+#endif
+
+            typedef void (*unary_t)(const real_t *, real_t *, std::size_t);
+            typedef void (*binary_t)(const real_t *, const real_t *, real_t *, std::size_t);
+
+            struct dispatch_table {
+                const char *isa;
+                unary_t exp;
+                unary_t sigmoid;
+                unary_t tanh;
+                unary_t softplus;
+                binary_t softplus_backward;
+            };
+
+            dispatch_table select_kernels() {
+#ifdef GNOL_X86_KERNELS
+                __builtin_cpu_init();
+
+                if (__builtin_cpu_supports("avx512f")) {
+                    dispatch_table table = {
+                        "avx512", exp_avx512, sigmoid_avx512, tanh_avx512,
+                        softplus_avx512, softplus_backward_avx512
+                    };
+                    return table;
+                }
+
+                if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                    dispatch_table table = {
+                        "avx2", exp_avx2, sigmoid_avx2, tanh_avx2,
+                        softplus_avx2, softplus_backward_avx2
+                    };
+                    return table;
+                }
+#endif
+                dispatch_table table = {
+                    "scalar", exp_generic, sigmoid_generic, tanh_generic,
+                    softplus_generic, softplus_backward_generic
+                };
+                return table;
+            }
+
+            const dispatch_table &active() {
+                static const dispatch_table table = select_kernels();
+                return table;
+            }
+        }
+
+        const char *isa() {
+            return active().isa;
+        }
+
+        real_t exp(real_t x) {
+            return exp_scalar(x);
+        }
+
+        void exp(const real_t *input, real_t *output, std::size_t n) {
+            active().exp(input, output, n);
+        }
+
+        void sigmoid(const real_t *input, real_t *output, std::size_t n) {
+            active().sigmoid(input, output, n);
+        }
+
+        void sigmoid_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                grad_input[i] += grad_output[i]*(1 - output[i])*output[i];
+        }
+
+        void tanh(const real_t *input, real_t *output, std::size_t n) {
+            active().tanh(input, output, n);
+        }
+
+        void tanh_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                grad_input[i] += grad_output[i]*(1 - output[i]*output[i]);
+        }
+
+        void relu(const real_t *input, real_t *output, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                output[i] = input[i] > 0 ? input[i] : 0;
+        }
+
+        void relu_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++)
+                grad_input[i] += output[i] > 0 ? grad_output[i] : 0;
+        }
+
+        void softplus(const real_t *input, real_t *output, std::size_t n) {
+            active().softplus(input, output, n);
+        }
+
+        void softplus_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n) {
+            active().softplus_backward(output, grad_output, grad_input, n);
+        }
+
+        void lstm_forward(real_t *gates, const real_t *c_prev, real_t *c, real_t *tanh_c, real_t *h, std::size_t n) {
+            const dispatch_table &table = active();
+
+            // the three sigmoid gates are contiguous, so one vectorized
+            // pass covers them
+            table.sigmoid(gates, gates, 3*n);
+            table.tanh(gates + 3*n, gates + 3*n, n);
+
+            const real_t *i_gate = gates, *f_gate = gates + n;
+            const real_t *o_gate = gates + 2*n, *g_gate = gates + 3*n;
+
+            for (std::size_t k = 0; k < n; k++)
+                c[k] = f_gate[k]*c_prev[k] + i_gate[k]*g_gate[k];
+
+            table.tanh(c, tanh_c, n);
+
+            for (std::size_t k = 0; k < n; k++)
+                h[k] = o_gate[k]*tanh_c[k];
+        }
+
+        void lstm_backward(const real_t *gates, const real_t *c_prev, const real_t *tanh_c,
+                           const real_t *grad_h, const real_t *grad_c,
+                           real_t *grad_gates, real_t *grad_c_prev, std::size_t n)
+        {
+            const real_t *i_gate = gates, *f_gate = gates + n;
+            const real_t *o_gate = gates + 2*n, *g_gate = gates + 3*n;
+
+            real_t *grad_i = grad_gates, *grad_f = grad_gates + n;
+            real_t *grad_o = grad_gates + 2*n, *grad_g = grad_gates + 3*n;
+
+            for (std::size_t k = 0; k < n; k++) {
+                const real_t t = tanh_c[k];
+                const real_t dc = grad_c[k] + grad_h[k]*o_gate[k]*(1 - t*t);
+
+                grad_i[k] = dc*g_gate[k]*i_gate[k]*(1 - i_gate[k]);
+                grad_f[k] = dc*c_prev[k]*f_gate[k]*(1 - f_gate[k]);
+                grad_o[k] = grad_h[k]*t*o_gate[k]*(1 - o_gate[k]);
+                grad_g[k] = dc*i_gate[k]*(1 - g_gate[k]*g_gate[k]);
+
+                grad_c_prev[k] += dc*f_gate[k];
+            }
+        }
+
+        void gru_forward(real_t *gates, const real_t *hidden_gates, const real_t *h_prev, real_t *h, std::size_t n) {
+            const dispatch_table &table = active();
+
+            for (std::size_t k = 0; k < 2*n; k++)
+                gates[k] += hidden_gates[k];
+            table.sigmoid(gates, gates, 2*n);
+
+            const real_t *r_gate = gates, *z_gate = gates + n;
+            real_t *candidate = gates + 2*n;
+
+            // the reset gate scales what the previous state contributes
+            // to the candidate
+            for (std::size_t k = 0; k < n; k++)
+                candidate[k] += r_gate[k]*hidden_gates[2*n + k];
+            table.tanh(candidate, candidate, n);
+
+            for (std::size_t k = 0; k < n; k++)
+                h[k] = (1 - z_gate[k])*candidate[k] + z_gate[k]*h_prev[k];
+        }
+
+        void gru_backward(const real_t *gates, const real_t *hidden_gates, const real_t *h_prev,
+                          const real_t *grad_h, real_t *grad_gates, real_t *grad_hidden_gates,
+                          real_t *grad_h_prev, std::size_t n)
+        {
+            const real_t *r_gate = gates, *z_gate = gates + n, *candidate = gates + 2*n;
+
+            for (std::size_t k = 0; k < n; k++) {
+                const real_t r = r_gate[k], z = z_gate[k], c = candidate[k];
+
+                const real_t grad_candidate = grad_h[k]*(1 - z)*(1 - c*c);
+                const real_t grad_r = grad_candidate*hidden_gates[2*n + k]*r*(1 - r);
+                const real_t grad_z = grad_h[k]*(h_prev[k] - c)*z*(1 - z);
+
+                grad_gates[k] = grad_r;
+                grad_gates[n + k] = grad_z;
+                grad_gates[2*n + k] = grad_candidate;
+
+                grad_hidden_gates[k] = grad_r;
+                grad_hidden_gates[n + k] = grad_z;
+                grad_hidden_gates[2*n + k] = grad_candidate*r;
+
+                grad_h_prev[k] += grad_h[k]*z;
+            }
+        }
+    }
+}
@@ -0,0 +1,81 @@
+//
+//  kernels.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/6/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef kernels_hpp
+#define kernels_hpp
+
+#include "utility.hpp"
+
+namespace gnol {
+    /*!
+     Elementwise kernels over raw buffers. On x86 the exp based kernels
+     are vectorized with AVX2 or AVX-512, chosen at runtime from what the
+     CPU supports, with a portable scalar fallback.
+
+     exp is evaluated with a polynomial (not libm) whose relative error
+     against libm is below 1e-14 over its whole range; inputs are
+     clamped to [-708, 709] so results never overflow or become denormal.
+     Every variant evaluates the same polynomial, so results do not
+     depend on the instruction set used.
+
+     Backward kernels accumulate into grad_input, matching the
+     convention of GradientModule::backward.
+     */
+    namespace kernels {
+        // name of the instruction set the kernels dispatch to
+        const char *isa();
+
+        real_t exp(real_t x);
+        void exp(const real_t *input, real_t *output, std::size_t n);
+
+        void sigmoid(const real_t *input, real_t *output, std::size_t n);
+        void sigmoid_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n);
+
+        void tanh(const real_t *input, real_t *output, std::size_t n);
+        void tanh_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n);
+
+        void relu(const real_t *input, real_t *output, std::size_t n);
+        void relu_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n);
+
+        // the derivative of softplus is recovered from its output, so
+        // backward does not need the input
+        void softplus(const real_t *input, real_t *output, std::size_t n);
+        void softplus_backward(const real_t *output, const real_t *grad_output, real_t *grad_input, std::size_t n);
+
+        /*!
+         Fused recurrent cells, for one sample of n hidden units.
+
+         lstm_forward takes the 4n gate preactivations (input, forget,
+         output and candidate, in that order) and replaces them with the
+         gate activations, then writes the new cell state, its tanh and
+         the new hidden state. lstm_backward turns the gradients of the
+         hidden and cell state into gradients of the 4n preactivations
+         (overwritten) and of the previous cell state (accumulated).
+         */
+        void lstm_forward(real_t *gates, const real_t *c_prev, real_t *c, real_t *tanh_c, real_t *h, std::size_t n);
+        void lstm_backward(const real_t *gates, const real_t *c_prev, const real_t *tanh_c,
+                           const real_t *grad_h, const real_t *grad_c,
+                           real_t *grad_gates, real_t *grad_c_prev, std::size_t n);
+
+        /*!
+         gru_forward takes the 3n preactivations from the input (reset,
+         update and candidate) and the 3n from the previous state, and
+         replaces the former with the gate activations; the candidate's
+         part from the previous state is kept for backward. gru_backward
+         writes the gradients of both sets of preactivations and
+         accumulates the part of the previous state's gradient that skips
+         them.
+         */
+        void gru_forward(real_t *gates, const real_t *hidden_gates, const real_t *h_prev, real_t *h, std::size_t n);
+        void gru_backward(const real_t *gates, const real_t *hidden_gates, const real_t *h_prev,
+                          const real_t *grad_h, real_t *grad_gates, real_t *grad_hidden_gates,
+                          real_t *grad_h_prev, std::size_t n);
+    }
+}
+
+#endif /* kernels_hpp */
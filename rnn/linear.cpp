@@ -13,16 +13,16 @@ using namespace gnol;
 LinearModule::LinearModule(LinearParams &&params, LinearGradParams &&grad_params):
     ParameterizedModule(
         LinearParams(std::move(params.weight),
-                     make_vector(params.weight->n_rows)),
+                     make_vector(params.weight->n_cols)),
         LinearGradParams(std::move(grad_params.weight),
-                         make_vector(grad_params.weight->n_rows)),
+                         make_vector(grad_params.weight->n_cols)),
         {params.weight->n_cols, params.weight->n_rows}) {}
 
 
 LinearModule::LinearModule(variable<matrix_t> &weight, variable<matrix_t> &grad_weight):
     ParameterizedModule(
-        LinearParams(weight),
-        LinearGradParams(grad_weight),
+        LinearParams(share(weight), make_vector(weight->n_cols)),
+        LinearGradParams(share(grad_weight), make_vector(grad_weight->n_cols)),
         {weight->n_cols, weight->n_rows}) {}
 
 void LinearParams::resize(ssize_t<2> size) {
@@ -39,6 +39,11 @@ parameter_list LinearParams::flatten() {
     return std::move(params);
 }
 
+void LinearParams::visit(parameter_visitor &visitor) {
+    visitor(weight);
+    visitor(bias);
+}
+
 void LinearGradParams::clear() {
     weight->zeros();
     bias->zeros();
@@ -52,3 +57,8 @@ parameter_list LinearGradParams::flatten() {
     
     return std::move(params);
 }
+
+void LinearGradParams::visit(parameter_visitor &visitor) {
+    visitor(weight);
+    visitor(bias);
+}
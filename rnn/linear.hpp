@@ -68,6 +68,7 @@ namespace gnol {
         
         void resize(ssize_t<2> size);
         parameter_list flatten();
+        void visit(parameter_visitor &visitor);
     };
     
     struct LinearGradParams {
@@ -111,18 +112,25 @@ namespace gnol {
         
         void clear();
         parameter_list flatten();
+        void visit(parameter_visitor &visitor);
     };
     
+    /*!
+     Each column of input is a separate sample, so a batch of N samples is
+     computed with a single matrix-matrix product and the bias is
+     broadcast across the columns.
+     */
     struct LinearOp {
         void operator ()(LinearParams &params, const matrix_t &input, matrix_t &output) {
-            output = params.weight->t()*input + *params.bias;
+            output = params.weight->t()*input;
+            output.each_col() += *params.bias;
         }
     };
     
     struct LinearGradient {
         void operator ()(LinearParams &params, LinearGradParams &gparams, const matrix_t &input, const matrix_t &grad_output, matrix_t &grad_input) {
-            *gparams.weight += (grad_output*input.t()).t();
-            *gparams.bias += grad_output;
+            *gparams.weight += input*grad_output.t();
+            *gparams.bias += sum(grad_output, 1);
             grad_input += *(params.weight)*grad_output;
         }
     };
@@ -142,14 +150,15 @@ namespace gnol {
     
     struct TransposedLinearOp {
         void operator ()(LinearParams &params, const matrix_t &input, matrix_t &output) {
-            output = (*params.weight)*input + *params.bias;
+            output = (*params.weight)*input;
+            output.each_col() += *params.bias;
         }
     };
     
     struct TransposedLinearGradient {
         void operator ()(LinearParams &params, LinearGradParams &gparams, const matrix_t &input, const matrix_t &grad_output, matrix_t &grad_input) {
-            *gparams.weight += (input*grad_output.t()).t(); // TODO: simplify
-            *gparams.bias += grad_output;
+            *gparams.weight += grad_output*input.t();
+            *gparams.bias += sum(grad_output, 1);
             grad_input += params.weight->t()*grad_output;
         }
     };
@@ -0,0 +1,337 @@
+//
+//  model.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/15/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "model.hpp"
+#include "sequence.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace gnol {
+    namespace {
+        struct header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t value_size;
+            std::uint64_t alignment;
+            std::uint64_t count;
+            std::uint64_t length;
+        };
+
+        // rows, cols, offset and length of the name, followed by the name
+        const std::size_t record_size = 4*sizeof(std::uint64_t);
+
+        struct named_parameter {
+            std::string name;
+            real_t *memory;
+            std::size_t rows, cols;
+            std::function<void (real_t *)> rebind;
+        };
+
+        /*!
+         Collects every parameter of a module along with its name. Shared
+         parameters show up once per module sharing them.
+         */
+        struct collect_named: public parameter_visitor {
+            std::vector<named_parameter> params;
+            std::string prefix;
+            std::size_t index;
+
+            collect_named(): index(0) {}
+
+            template <typename MatrixT>
+            void add(variable<MatrixT> &param) {
+                // parameters are members of the module, so they live
+                // at least as long as the binding
+                variable<MatrixT> *var = &param;
+                params.push_back({prefix + std::to_string(index++), param->memptr(),
+                    param->n_rows, param->n_cols,
+                    [var](real_t *memory) { var->rebind(memory); }});
+            }
+
+            void operator ()(variable<matrix_t> &param) { add(param); }
+            void operator ()(variable<vector_t> &param) { add(param); }
+        };
+
+        void walk(GradientModule &mod, const std::string &prefix, collect_named &collect) {
+            if (auto seq = dynamic_cast<SequenceModule *>(&mod)) {
+                for (std::size_t i = 0; i < seq->size(); i++) {
+                    const std::string &name = seq->get_name(i);
+                    walk(*(*seq)[i], prefix + (name.empty() ? std::to_string(i) : name) + ".", collect);
+                }
+                return;
+            }
+
+            collect.prefix = prefix;
+            collect.index = 0;
+            mod.visit_parameters(collect);
+        }
+
+        std::size_t align(std::size_t offset, std::size_t alignment) {
+            return (offset + alignment - 1)/alignment*alignment;
+        }
+
+        void write_u64(std::ostream &os, std::uint64_t value) {
+            os.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+    }
+
+    void save_model(GradientModule &mod, const std::string &path, std::size_t alignment) {
+        if (alignment == 0)
+            alignment = std::size_t(sysconf(_SC_PAGESIZE));
+
+        if (alignment % sizeof(real_t) != 0)
+            throw std::invalid_argument("save_model: alignment has to be a multiple of the value size");
+
+        collect_named collect;
+        walk(mod, "", collect);
+
+        // shared parameters are only stored under the first name they
+        // were visited with
+        std::vector<const named_parameter *> stored;
+        std::map<const real_t *, std::size_t> seen;
+        std::size_t table = 0;
+
+        for (auto &param : collect.params) {
+            if (param.rows*param.cols == 0 || !seen.insert({param.memory, stored.size()}).second)
+                continue;
+
+            stored.push_back(&param);
+            table += record_size + param.name.size();
+        }
+
+        // values start on the next boundary after the table, and without
+        // any the file ends with it
+        std::vector<std::size_t> offsets;
+        std::size_t length = sizeof(header) + table;
+        if (!stored.empty())
+            length = align(length, alignment);
+
+        for (auto param : stored) {
+            offsets.push_back(length);
+            length += param->rows*param->cols*sizeof(real_t);
+
+            if (param != stored.back())
+                length = align(length, alignment);
+        }
+
+        header head;
+        std::memcpy(head.magic, model_format::magic, sizeof(head.magic));
+        head.version = model_format::version;
+        head.value_size = sizeof(real_t);
+        head.alignment = alignment;
+        head.count = stored.size();
+        head.length = length;
+
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error("save_model: can't open " + path);
+
+        os.write(reinterpret_cast<const char *>(&head), sizeof(head));
+
+        for (std::size_t i = 0; i < stored.size(); i++) {
+            write_u64(os, stored[i]->rows);
+            write_u64(os, stored[i]->cols);
+            write_u64(os, offsets[i]);
+            write_u64(os, stored[i]->name.size());
+            os.write(stored[i]->name.data(), stored[i]->name.size());
+        }
+
+        for (std::size_t i = 0; i < stored.size(); i++) {
+            const std::size_t padding = offsets[i] - std::size_t(os.tellp());
+            std::fill_n(std::ostreambuf_iterator<char>(os), padding, '\0');
+
+            os.write(reinterpret_cast<const char *>(stored[i]->memory),
+                     stored[i]->rows*stored[i]->cols*sizeof(real_t));
+        }
+
+        if (!os)
+            throw std::runtime_error("save_model: failed writing " + path);
+    }
+
+    mapped_model::mapped_model(const std::string &name, access_t access, source_t source):
+        memory(nullptr),
+        length(0),
+        access(access)
+    {
+        const int fd = source == file ? ::open(name.c_str(), O_RDONLY) : shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            throw std::runtime_error("mapped_model: can't open " + name);
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("mapped_model: can't read " + name);
+        }
+
+        length = std::size_t(info.st_size);
+        if (access == read_only)
+            memory = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        else
+            memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        // the mapping keeps the file alive by itself
+        ::close(fd);
+
+        if (memory == MAP_FAILED)
+            throw std::runtime_error("mapped_model: can't map " + name);
+
+        try {
+            read_table();
+        } catch (...) {
+            munmap(memory, length);
+            throw;
+        }
+    }
+
+    mapped_model::~mapped_model() {
+        munmap(memory, length);
+    }
+
+    void mapped_model::read_table() {
+        const char *bytes = static_cast<const char *>(memory);
+
+        header head;
+        if (length < sizeof(head))
+            throw std::runtime_error("mapped_model: file is too short");
+
+        std::memcpy(&head, bytes, sizeof(head));
+
+        if (std::memcmp(head.magic, model_format::magic, sizeof(head.magic)) != 0)
+            throw std::runtime_error("mapped_model: not a model file");
+
+        if (head.version != model_format::version || head.value_size != sizeof(real_t))
+            throw std::runtime_error("mapped_model: unsupported version or value type");
+
+        // shared memory objects can be rounded up to a whole page
+        if (head.length > length)
+            throw std::runtime_error("mapped_model: file is truncated");
+
+        std::size_t pos = sizeof(head);
+        for (std::size_t i = 0; i < head.count; i++) {
+            if (pos + record_size > length)
+                throw std::runtime_error("mapped_model: table is truncated");
+
+            std::uint64_t record[4];
+            std::memcpy(record, bytes + pos, record_size);
+            pos += record_size;
+
+            if (record[3] > length - pos)
+                throw std::runtime_error("mapped_model: table is truncated");
+
+            std::string name(bytes + pos, record[3]);
+            pos += record[3];
+
+            entry e = {std::size_t(record[0]), std::size_t(record[1]), std::size_t(record[2])};
+            if (e.offset % sizeof(real_t) != 0 || e.offset > length ||
+                e.rows*e.cols > (length - e.offset)/sizeof(real_t))
+            {
+                throw std::runtime_error("mapped_model: parameter " + name + " lies outside the file");
+            }
+
+            entries[name] = e;
+        }
+    }
+
+    void mapped_model::bind(GradientModule &mod) {
+        collect_named collect;
+        walk(mod, "", collect);
+
+        // find where everything goes before moving anything, so a
+        // mismatch leaves mod as it was
+        std::vector<real_t *> targets(collect.params.size(), nullptr);
+        std::map<const real_t *, real_t *> moved;
+
+        for (std::size_t i = 0; i < collect.params.size(); i++) {
+            const auto &param = collect.params[i];
+            if (param.rows*param.cols == 0)
+                continue;
+
+            auto shared = moved.find(param.memory);
+            if (shared != moved.end()) {
+                targets[i] = shared->second;
+                continue;
+            }
+
+            auto found = entries.find(param.name);
+            if (found == entries.end())
+                throw std::invalid_argument("mapped_model: no parameter " + param.name + " in the file");
+
+            if (found->second.rows != param.rows || found->second.cols != param.cols)
+                throw std::invalid_argument("mapped_model: parameter " + param.name + " has a different shape");
+
+            targets[i] = reinterpret_cast<real_t *>(static_cast<char *>(memory) + found->second.offset);
+            moved[param.memory] = targets[i];
+        }
+
+        for (std::size_t i = 0; i < collect.params.size(); i++) {
+            if (targets[i])
+                collect.params[i].rebind(targets[i]);
+        }
+    }
+
+    std::shared_ptr<mapped_model> load_model(GradientModule &mod, const std::string &path,
+                                             mapped_model::access_t access)
+    {
+        auto model = std::make_shared<mapped_model>(path, access);
+        model->bind(mod);
+        return model;
+    }
+
+    void publish_model(const std::string &path, const std::string &name) {
+        std::ifstream is(path, std::ios::binary | std::ios::ate);
+        if (!is)
+            throw std::runtime_error("publish_model: can't open " + path);
+
+        const std::size_t length = std::size_t(is.tellg());
+        is.seekg(0);
+
+        // a new object rather than the old one resized: some systems
+        // (macOS) only allow ftruncate once, on a new object, and
+        // workers mapping the old one keep what they have
+        shm_unlink(name.c_str());
+
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0)
+            throw std::runtime_error("publish_model: can't create " + name);
+
+        void *memory = MAP_FAILED;
+        if (ftruncate(fd, off_t(length)) == 0)
+            memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        // don't leave a half made object behind
+        if (memory == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            throw std::runtime_error("publish_model: can't map " + name);
+        }
+
+        is.read(static_cast<char *>(memory), std::streamsize(length));
+        munmap(memory, length);
+
+        if (!is) {
+            shm_unlink(name.c_str());
+            throw std::runtime_error("publish_model: failed reading " + path);
+        }
+    }
+
+    void unpublish_model(const std::string &name) {
+        if (shm_unlink(name.c_str()) != 0)
+            throw std::runtime_error("unpublish_model: can't remove " + name);
+    }
+}
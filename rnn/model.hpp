@@ -0,0 +1,119 @@
+//
+//  model.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/15/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef model_hpp
+#define model_hpp
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "module.hpp"
+
+namespace gnol {
+    /*!
+     Model files hold the parameters of a module, so they can be mapped
+     into memory and used in place rather than parsed and copied.
+
+     A file starts with a header (magic, format version, size of a value,
+     alignment) and a table of parameters, each with a name, shape and the
+     offset of its values. The values of every parameter start on a page
+     boundary, in the same column-major layout as in memory.
+
+     Parameters are named by where they sit in the module: children of a
+     SequenceModule by their name (or position, if unnamed), and the
+     parameters of any other module by the order it visits them, e.g.
+     "encoder.0" for the weight of the child named "encoder". Parameters
+     shared between modules are stored once.
+     */
+    namespace model_format {
+        const char magic[8] = {'G', 'N', 'O', 'L', 'M', 'D', 'L', '\0'};
+        const std::uint32_t version = 1;
+    }
+
+    // writes the parameters of mod to path, each aligned to alignment
+    // bytes (the page size if 0)
+    void save_model(GradientModule &mod, const std::string &path, std::size_t alignment=0);
+
+    /*!
+     A model file mapped into memory. bind() points the parameters of a
+     module (built the same way as the one saved) at their values in the
+     mapping, without copying them; pages are only read from the file
+     when first touched. The mapping must outlive the modules bound to it.
+
+     By default the mapping is private: parameters can still be trained,
+     and pages written to are copied (and not written back to the file).
+
+     A read only mapping is shared instead, so every process mapping the
+     same model (a file, or a POSIX shared memory object filled by
+     publish_model()) uses the same physical pages. The pages can't be
+     written at all: anything that tries to change a bound parameter
+     (an optimizer step, a trainer) faults rather than quietly taking a
+     private copy. Inference (forward) only reads parameters, and
+     gradients are kept apart from them, so it is safe.
+
+     \code
+     // once per host
+     publish_model("model.gnol", "/model");
+
+     // in every worker
+     mapped_model model("/model", mapped_model::read_only, mapped_model::shared_memory);
+     model.bind(*seq);
+     */
+    class mapped_model {
+    public:
+        enum access_t { copy_on_write, read_only };
+        enum source_t { file, shared_memory };
+
+        struct entry {
+            std::size_t rows, cols;
+            std::size_t offset;
+        };
+    protected:
+        void *memory;
+        std::size_t length;
+        access_t access;
+        std::map<std::string, entry> entries;
+    public:
+        explicit mapped_model(const std::string &name, access_t access=copy_on_write, source_t source=file);
+        ~mapped_model();
+
+        mapped_model(const mapped_model &) = delete;
+        mapped_model &operator =(const mapped_model &) = delete;
+
+        std::size_t size() const { return length; }
+        bool is_read_only() const { return access == read_only; }
+        const std::map<std::string, entry> &get_entries() const { return entries; }
+
+        /*!
+         Binds every parameter of mod to the mapping. Throws
+         std::invalid_argument, leaving mod untouched, if a parameter is
+         missing from the file or has a different shape.
+         */
+        void bind(GradientModule &mod);
+    protected:
+        void read_table();
+    };
+
+    std::shared_ptr<mapped_model> load_model(GradientModule &mod, const std::string &path,
+                                             mapped_model::access_t access=mapped_model::copy_on_write);
+
+    /*!
+     Copies the model file at path into a new POSIX shared memory object
+     name (which starts with a /), so workers can map it read only
+     without the file. An object already published under name is
+     replaced, and nothing is left under name if publishing fails.
+     unpublish_model() removes the name; workers that already mapped it
+     (or an object it replaced) keep their mapping.
+     */
+    void publish_model(const std::string &path, const std::string &name);
+    void unpublish_model(const std::string &name);
+}
+
+#endif /* model_hpp */
@@ -8,8 +8,17 @@
 
 #include "module.hpp"
 
+#include <stdexcept>
+
 using namespace gnol;
 
+namespace {
+    struct release_parameters: public parameter_visitor {
+        void operator ()(variable<matrix_t> &param) { param.release(); }
+        void operator ()(variable<vector_t> &param) { param.release(); }
+    };
+}
+
 Module::Module(size_t input_size, size_t output_size):
     input_size(input_size),
     output_size(output_size),
@@ -18,10 +27,31 @@ Module::Module(size_t input_size, size_t output_size):
 }
 
 GradientModule::GradientModule(size_t input_size, size_t output_size):
-    Module(input_size, output_size)
+    Module(input_size, output_size),
+    frozen(false)
 {
     if (input_size.dims() == 1)
         grad_input.resize(input_size[0], 1);
     else
         grad_input.resize(input_size[0], input_size[1]);
 }
+
+void GradientModule::freeze() {
+    grad_input.reset();
+    
+    release_parameters release;
+    visit_deriv_parameters(release);
+    
+    frozen = true;
+}
+
+void GradientModule::match_grad_input(const matrix_t &input) {
+    if (frozen)
+        throw std::logic_error("GradientModule: backward on a module frozen for inference");
+    
+    // inputs are batched by column, so the number of columns can change
+    // between calls; an accumulated gradient from a different batch size
+    // is meaningless, so start over from zero
+    if (grad_input.n_rows != input.n_rows || grad_input.n_cols != input.n_cols)
+        grad_input.zeros(input.n_rows, input.n_cols);
+}
@@ -11,6 +11,7 @@
 
 #include <armadillo>
 
+#include <functional>
 #include <list>
 #include <utility>
 
@@ -38,19 +39,54 @@ namespace gnol {
         
         virtual matrix_t &forward(const matrix_t &input) = 0;
         virtual parameter_list flatten_parameters() = 0;
+        virtual void visit_parameters(parameter_visitor &visitor) {}
     };
     
     class GradientModule: public Module {
     protected:
         matrix_t grad_input;
+        bool frozen;
+        
+        void match_grad_input(const matrix_t &input);
     public:
         GradientModule(size_t input_size, size_t output_size);
         
         matrix_t &get_grad_input() { return grad_input; }
         
+        /*!
+         Switches the module to inference only: the gradient of the input
+         and of every parameter are released (gradients shared with
+         modules that aren't frozen stay with them), and backward throws
+         std::logic_error from then on. Sequence, Concat and Join modules
+         freeze their children, and RecurrentModule drops the gradient
+         part of its block; other buffers a module keeps for backward
+         (the saved gates of LSTMModule, say) stay allocated. Buffers are
+         released once built, so freezing lowers the memory held after
+         construction, not the peak during it.
+         */
+        virtual void freeze();
+        bool is_frozen() const { return frozen; }
+        
         virtual void clear() { grad_input.zeros(); }
         virtual matrix_t &backward(const matrix_t &input, const matrix_t &grad_output) = 0;
         virtual parameter_list flatten_deriv_parameters() = 0;
+        virtual void visit_deriv_parameters(parameter_visitor &visitor) {}
+        
+        // calls visitor on the module and, for containers, on every
+        // module inside it (at any depth)
+        typedef std::function<void (GradientModule &)> module_visitor;
+        virtual void visit_modules(const module_visitor &visitor) { visitor(*this); }
+        
+        // whether backward() reads the values of its input, or only its
+        // shape, and whether it reads the module's own output (so the
+        // output has to survive until backward)
+        virtual bool backward_uses_input() const { return true; }
+        virtual bool backward_uses_output() const { return false; }
+        
+        // whether forward() can overwrite its input with its output
+        virtual bool supports_inplace() const { return false; }
+        virtual void set_inplace(bool enable) {}
+        virtual bool is_inplace() const { return false; }
     };
         
     template <typename OpT, typename ParamT, typename GradOpT, typename GradParamT>
@@ -86,6 +122,7 @@ namespace gnol {
         }
         
         matrix_t &backward(const matrix_t &input, const matrix_t &grad_output) {
+            match_grad_input(input);
             grad(params, grad_params, input, grad_output, grad_input);
             return grad_input;
         }
@@ -96,6 +133,9 @@ namespace gnol {
         virtual parameter_list flatten_parameters() { return params.flatten(); }
         virtual parameter_list flatten_deriv_parameters() { return grad_params.flatten(); }
         
+        virtual void visit_parameters(parameter_visitor &visitor) { params.visit(visitor); }
+        virtual void visit_deriv_parameters(parameter_visitor &visitor) { grad_params.visit(visitor); }
+        
         virtual void clear() {
             grad_input.zeros();
             grad_params.clear();
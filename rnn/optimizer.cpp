@@ -0,0 +1,201 @@
+//
+//  optimizer.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/10/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace gnol {
+    namespace {
+        /*
+         The update kernels take restrict pointers and keep their loop
+         bodies free of branches (clearing is a template parameter) so the
+         compiler can vectorize them.
+         */
+        template <bool Clear>
+        void sgd(real_t *__restrict p, real_t *__restrict g, std::size_t n, real_t rate) {
+            for (std::size_t i = 0; i < n; i++) {
+                p[i] -= rate*g[i];
+                if (Clear) g[i] = 0;
+            }
+        }
+
+        template <bool Clear>
+        void momentum_sgd(real_t *__restrict p, real_t *__restrict g, real_t *__restrict v,
+                          std::size_t n, real_t rate, real_t momentum)
+        {
+            for (std::size_t i = 0; i < n; i++) {
+                v[i] = momentum*v[i] + g[i];
+                p[i] -= rate*v[i];
+                if (Clear) g[i] = 0;
+            }
+        }
+
+        template <bool Clear>
+        void adam(real_t *__restrict p, real_t *__restrict g, real_t *__restrict m, real_t *__restrict v,
+                  std::size_t n, real_t step_size, real_t beta1, real_t beta2, real_t epsilon)
+        {
+            for (std::size_t i = 0; i < n; i++) {
+                m[i] = beta1*m[i] + (1 - beta1)*g[i];
+                v[i] = beta2*v[i] + (1 - beta2)*g[i]*g[i];
+                p[i] -= step_size*m[i]/(std::sqrt(v[i]) + epsilon);
+                if (Clear) g[i] = 0;
+            }
+        }
+
+        template <bool Clear>
+        void adagrad(real_t *__restrict p, real_t *__restrict g, real_t *__restrict h,
+                     std::size_t n, real_t rate, real_t epsilon)
+        {
+            for (std::size_t i = 0; i < n; i++) {
+                h[i] += g[i]*g[i];
+                p[i] -= rate*g[i]/(std::sqrt(h[i]) + epsilon);
+                if (Clear) g[i] = 0;
+            }
+        }
+    }
+
+    Optimizer::Optimizer(GradientModule &mod):
+        params(mod),
+        grads(mod, parameter_arena::gradients),
+        pool(&thread_pool::global())
+    {
+        if (params.size() != grads.size())
+            throw std::invalid_argument("Optimizer: parameters and gradients don't line up");
+    }
+
+    Optimizer::Optimizer(parameter_arena params, parameter_arena grads):
+        params(params),
+        grads(grads),
+        pool(&thread_pool::global())
+    {
+        if (params.size() != grads.size())
+            throw std::invalid_argument("Optimizer: parameters and gradients don't line up");
+    }
+
+    void Optimizer::step(bool clear_gradients) {
+        begin_step();
+
+        const std::size_t n = params.size();
+        if (pool == nullptr || pool->size() == 0 || n <= block_size) {
+            update(0, n, clear_gradients);
+            return;
+        }
+
+        task_group group(*pool);
+        for (std::size_t first = 0; first < n; first += block_size) {
+            const std::size_t last = std::min<std::size_t>(n, first + block_size);
+            group.run([this, first, last, clear_gradients]() {
+                update(first, last, clear_gradients);
+            });
+        }
+        group.wait();
+    }
+
+    std::shared_ptr<real_t> Optimizer::make_state() {
+        auto state = allocate_aligned(params.size(), parameter_arena::alignment);
+        std::fill(state.get(), state.get() + params.size(), 0);
+        return state;
+    }
+
+    SGDOptimizer::SGDOptimizer(GradientModule &mod, real_t rate):
+        Optimizer(mod),
+        rate(rate) {}
+
+    SGDOptimizer::SGDOptimizer(parameter_arena params, parameter_arena grads, real_t rate):
+        Optimizer(params, grads),
+        rate(rate) {}
+
+    void SGDOptimizer::update(std::size_t first, std::size_t last, bool clear) {
+        real_t *p = params.data() + first;
+        real_t *g = grads.data() + first;
+
+        if (clear)
+            sgd<true>(p, g, last - first, rate);
+        else
+            sgd<false>(p, g, last - first, rate);
+    }
+
+    MomentumOptimizer::MomentumOptimizer(GradientModule &mod, real_t rate, real_t momentum):
+        Optimizer(mod),
+        rate(rate),
+        momentum(momentum),
+        velocity(make_state()) {}
+
+    MomentumOptimizer::MomentumOptimizer(parameter_arena params, parameter_arena grads,
+                                         real_t rate, real_t momentum):
+        Optimizer(params, grads),
+        rate(rate),
+        momentum(momentum),
+        velocity(make_state()) {}
+
+    void MomentumOptimizer::update(std::size_t first, std::size_t last, bool clear) {
+        real_t *p = params.data() + first;
+        real_t *g = grads.data() + first;
+        real_t *v = velocity.get() + first;
+
+        if (clear)
+            momentum_sgd<true>(p, g, v, last - first, rate, momentum);
+        else
+            momentum_sgd<false>(p, g, v, last - first, rate, momentum);
+    }
+
+    AdamOptimizer::AdamOptimizer(GradientModule &mod, real_t rate,
+                                 real_t beta1, real_t beta2, real_t epsilon):
+        Optimizer(mod),
+        rate(rate), beta1(beta1), beta2(beta2), epsilon(epsilon),
+        m(make_state()), v(make_state()),
+        t(0), step_size(0) {}
+
+    AdamOptimizer::AdamOptimizer(parameter_arena params, parameter_arena grads, real_t rate,
+                                 real_t beta1, real_t beta2, real_t epsilon):
+        Optimizer(params, grads),
+        rate(rate), beta1(beta1), beta2(beta2), epsilon(epsilon),
+        m(make_state()), v(make_state()),
+        t(0), step_size(0) {}
+
+    void AdamOptimizer::begin_step() {
+        t++;
+        step_size = rate*std::sqrt(1 - std::pow(beta2, t))/(1 - std::pow(beta1, t));
+    }
+
+    void AdamOptimizer::update(std::size_t first, std::size_t last, bool clear) {
+        real_t *p = params.data() + first;
+        real_t *g = grads.data() + first;
+
+        if (clear)
+            adam<true>(p, g, m.get() + first, v.get() + first, last - first, step_size, beta1, beta2, epsilon);
+        else
+            adam<false>(p, g, m.get() + first, v.get() + first, last - first, step_size, beta1, beta2, epsilon);
+    }
+
+    AdagradOptimizer::AdagradOptimizer(GradientModule &mod, real_t rate, real_t epsilon):
+        Optimizer(mod),
+        rate(rate),
+        epsilon(epsilon),
+        history(make_state()) {}
+
+    AdagradOptimizer::AdagradOptimizer(parameter_arena params, parameter_arena grads,
+                                       real_t rate, real_t epsilon):
+        Optimizer(params, grads),
+        rate(rate),
+        epsilon(epsilon),
+        history(make_state()) {}
+
+    void AdagradOptimizer::update(std::size_t first, std::size_t last, bool clear) {
+        real_t *p = params.data() + first;
+        real_t *g = grads.data() + first;
+
+        if (clear)
+            adagrad<true>(p, g, history.get() + first, last - first, rate, epsilon);
+        else
+            adagrad<false>(p, g, history.get() + first, last - first, rate, epsilon);
+    }
+}
@@ -0,0 +1,128 @@
+//
+//  optimizer.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/10/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef optimizer_hpp
+#define optimizer_hpp
+
+#include "module.hpp"
+#include "arena.hpp"
+#include "thread_pool.hpp"
+
+namespace gnol {
+    /*!
+     An Optimizer updates the parameters of a module from its gradients.
+     Parameters, gradients and any state the optimizer keeps (momentum,
+     moment estimates) are each one contiguous buffer laid out the same
+     way, so an update is a single pass that reads each value once and
+     writes it once, clearing the gradient for the next batch as it goes.
+
+     Large models are updated a block at a time on a thread pool.
+
+     \code
+     auto model = make_sequence({
+        make_module<LinearModule>(size(10, 5)),
+        make_module<SigmoidModule>(5)
+     });
+
+     AdamOptimizer adam(*model, 0.001);
+
+     for (auto &batch : batches) {
+        // forward and backward
+        adam.step();
+     }
+     */
+    class Optimizer {
+    public:
+        // number of values each task of an update handles
+        static const std::size_t block_size = 1 << 15;
+    protected:
+        parameter_arena params;
+        parameter_arena grads;
+        thread_pool *pool;
+    public:
+        /*!
+         Moves the parameters and gradients of mod into arenas of their
+         own. Use the other constructor for modules whose parameters are
+         already in an arena (e.g. those of a trainer).
+         */
+        Optimizer(GradientModule &mod);
+        Optimizer(parameter_arena params, parameter_arena grads);
+        virtual ~Optimizer() {}
+
+        parameter_arena &get_parameters() { return params; }
+        parameter_arena &get_gradients() { return grads; }
+
+        // runs updates on pool (the default), or on the calling thread
+        // when pool is null
+        void set_pool(thread_pool *pool) { this->pool = pool; }
+
+        // updates every parameter, zeroing the gradients unless told not to
+        void step(bool clear_gradients=true);
+    protected:
+        virtual void begin_step() {}
+
+        // updates values [first, last)
+        virtual void update(std::size_t first, std::size_t last, bool clear) = 0;
+
+        // a zero filled buffer parallel to the parameters
+        std::shared_ptr<real_t> make_state();
+    };
+
+    // p -= rate*g
+    class SGDOptimizer: public Optimizer {
+        real_t rate;
+    public:
+        SGDOptimizer(GradientModule &mod, real_t rate);
+        SGDOptimizer(parameter_arena params, parameter_arena grads, real_t rate);
+    protected:
+        void update(std::size_t first, std::size_t last, bool clear);
+    };
+
+    // v = momentum*v + g; p -= rate*v
+    class MomentumOptimizer: public Optimizer {
+        real_t rate, momentum;
+        std::shared_ptr<real_t> velocity;
+    public:
+        MomentumOptimizer(GradientModule &mod, real_t rate, real_t momentum=0.9);
+        MomentumOptimizer(parameter_arena params, parameter_arena grads, real_t rate, real_t momentum=0.9);
+    protected:
+        void update(std::size_t first, std::size_t last, bool clear);
+    };
+
+    /*!
+     Adam (Kingma and Ba, 2014), with the bias corrections folded into the
+     step size so the inner loop only keeps the two moment estimates.
+     */
+    class AdamOptimizer: public Optimizer {
+        real_t rate, beta1, beta2, epsilon;
+        std::shared_ptr<real_t> m, v;
+        std::size_t t;
+        real_t step_size;
+    public:
+        AdamOptimizer(GradientModule &mod, real_t rate=0.001,
+                      real_t beta1=0.9, real_t beta2=0.999, real_t epsilon=1e-8);
+        AdamOptimizer(parameter_arena params, parameter_arena grads, real_t rate=0.001,
+                      real_t beta1=0.9, real_t beta2=0.999, real_t epsilon=1e-8);
+    protected:
+        void begin_step();
+        void update(std::size_t first, std::size_t last, bool clear);
+    };
+
+    // h += g*g; p -= rate*g/(sqrt(h) + epsilon)
+    class AdagradOptimizer: public Optimizer {
+        real_t rate, epsilon;
+        std::shared_ptr<real_t> history;
+    public:
+        AdagradOptimizer(GradientModule &mod, real_t rate, real_t epsilon=1e-8);
+        AdagradOptimizer(parameter_arena params, parameter_arena grads, real_t rate, real_t epsilon=1e-8);
+    protected:
+        void update(std::size_t first, std::size_t last, bool clear);
+    };
+}
+
+#endif /* optimizer_hpp */
@@ -0,0 +1,358 @@
+//
+//  recurrent.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/13/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "recurrent.hpp"
+#include "arena.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+namespace gnol {
+    namespace {
+        // points m at memory, the same way variable::rebind() does
+        void bind_view(matrix_t &m, real_t *memory, std::size_t rows, std::size_t cols) {
+            m.~matrix_t();
+            new (&m) matrix_t(memory, rows, cols, false, false);
+        }
+
+        // rows of the step's input that come from the sequence
+        std::size_t sequence_rows(GradientModule &step) {
+            const std::size_t rows = step.get_input_size()[0];
+            const std::size_t hidden = step.get_output_size()[0];
+
+            if (rows <= hidden)
+                throw std::invalid_argument("RecurrentModule: step has to map input and hidden state to hidden state");
+
+            return rows - hidden;
+        }
+    }
+
+    RecurrentModule::RecurrentModule(factory_t step, std::size_t max_length, std::size_t batch_size):
+        RecurrentModule(step(), step, max_length, batch_size) {}
+
+    RecurrentModule::RecurrentModule(module_ptr first, factory_t step, std::size_t max_length, std::size_t batch_size):
+        GradientModule(sequence_rows(*first), first->get_output_size()[0]),
+        steps({first}),
+        n_input(sequence_rows(*first)),
+        n_hidden(first->get_output_size()[0]),
+        max_length(max_length),
+        batch_size(batch_size),
+        length(0),
+        dirty(max_length)
+    {
+        if (max_length == 0 || batch_size == 0)
+            throw std::invalid_argument("RecurrentModule: length and batch size have to be positive");
+
+        for (std::size_t t = 1; t < max_length; t++) {
+            auto copy = step();
+            tie_parameters(*copy, *steps.front());
+            tie_parameters(*copy, *steps.front(), parameter_arena::gradients);
+            steps.push_back(copy);
+        }
+
+        allocate();
+    }
+
+    void RecurrentModule::set_batch_size(std::size_t batch_size) {
+        if (batch_size == 0)
+            throw std::invalid_argument("RecurrentModule: batch size has to be positive");
+
+        if (batch_size != this->batch_size) {
+            this->batch_size = batch_size;
+            allocate();
+        }
+    }
+
+    void RecurrentModule::allocate() {
+        const std::size_t rows = n_input + n_hidden;
+        const std::size_t columns = max_length*batch_size;
+
+        // [ step inputs | outputs | grad_input | carry | grad_step ],
+        // without the gradients once frozen
+        const std::size_t gradients = frozen ? 0 : n_input*columns + 2*n_hidden*batch_size;
+        const std::size_t total = rows*columns + n_hidden*columns + gradients;
+        block = allocate_aligned(total);
+        std::fill(block.get(), block.get() + total, 0);
+
+        inputs = block.get();
+        outputs = inputs + rows*columns;
+        grad_inputs = carry = grad_step = nullptr;
+
+        initial.zeros(n_hidden, batch_size);
+
+        length = 0;
+        output.rebind(outputs, n_hidden, 0, false);
+
+        if (frozen) {
+            grad_input.reset();
+            return;
+        }
+
+        grad_inputs = outputs + n_hidden*columns;
+        carry = grad_inputs + n_input*columns;
+        grad_step = carry + n_hidden*batch_size;
+        bind_view(grad_input, grad_inputs, n_input, 0);
+    }
+
+    void RecurrentModule::freeze() {
+        for (auto &step : steps)
+            step->freeze();
+
+        GradientModule::freeze();
+        allocate();
+    }
+
+    void RecurrentModule::set_initial_state(const matrix_t &state) {
+        if (state.n_rows != n_hidden || state.n_cols != batch_size)
+            throw std::invalid_argument("RecurrentModule: state has to have a column per sample of the batch");
+
+        initial = state;
+    }
+
+    void RecurrentModule::carry_state() {
+        if (length == 0)
+            throw std::logic_error("RecurrentModule: no forward to carry the state of");
+
+        const real_t *last = outputs + (length - 1)*n_hidden*batch_size;
+        std::copy(last, last + n_hidden*batch_size, initial.memptr());
+    }
+
+    void RecurrentModule::clear() {
+        grad_input.zeros();
+
+        // only the steps a backward has run through since the last clear
+        // have anything to clear
+        const std::size_t used = std::max<std::size_t>(dirty, 1);
+        for (std::size_t t = 0; t < used; t++)
+            steps[t]->clear();
+
+        dirty = 0;
+    }
+
+    matrix_t &RecurrentModule::forward(const matrix_t &input) {
+        if (input.n_rows != n_input || input.n_cols % batch_size != 0)
+            throw std::invalid_argument("RecurrentModule: input has to be a time major sequence of the batch size");
+
+        const std::size_t T = input.n_cols/batch_size;
+        if (T == 0 || T > max_length)
+            throw std::invalid_argument("RecurrentModule: sequence is empty or longer than the maximum length");
+
+        const std::size_t rows = n_input + n_hidden;
+        const std::size_t stride = rows*batch_size;
+
+        // the first step starts from the initial state
+        for (std::size_t b = 0; b < batch_size; b++)
+            std::copy(initial.colptr(b), initial.colptr(b) + n_hidden, inputs + b*rows + n_input);
+
+        for (std::size_t t = 0; t < T; t++) {
+            matrix_t x(inputs + t*stride, rows, batch_size, false, true);
+
+            for (std::size_t b = 0; b < batch_size; b++) {
+                const real_t *column = input.colptr(t*batch_size + b);
+                std::copy(column, column + n_input, x.colptr(b));
+            }
+
+            const matrix_t &h = steps[t]->forward(x);
+            std::copy(h.memptr(), h.memptr() + n_hidden*batch_size, outputs + t*n_hidden*batch_size);
+
+            if (t + 1 < T) {
+                real_t *next = inputs + (t + 1)*stride;
+                for (std::size_t b = 0; b < batch_size; b++)
+                    std::copy(h.colptr(b), h.colptr(b) + n_hidden, next + b*rows + n_input);
+            }
+        }
+
+        length = T;
+        output.rebind(outputs, n_hidden, T*batch_size, false);
+        return *output;
+    }
+
+    matrix_t &RecurrentModule::backward(const matrix_t &input, const matrix_t &grad_output) {
+        if (frozen)
+            throw std::logic_error("RecurrentModule: backward on a module frozen for inference");
+
+        const std::size_t T = length;
+        if (grad_output.n_rows != n_hidden || grad_output.n_cols != T*batch_size)
+            throw std::invalid_argument("RecurrentModule: gradient doesn't match the last forward");
+
+        // as with match_grad_input(), a gradient of a different length
+        // starts over from zero
+        if (grad_input.n_cols != T*batch_size) {
+            bind_view(grad_input, grad_inputs, n_input, T*batch_size);
+            grad_input.zeros();
+        }
+
+        const std::size_t rows = n_input + n_hidden;
+        const std::size_t stride = rows*batch_size;
+        const std::size_t hidden = n_hidden*batch_size;
+
+        std::fill(carry, carry + hidden, 0);
+        matrix_t grad_h(grad_step, n_hidden, batch_size, false, true);
+
+        for (std::size_t s = T; s-- > 0;) {
+            const real_t *grad = grad_output.colptr(s*batch_size);
+            for (std::size_t i = 0; i < hidden; i++)
+                grad_step[i] = grad[i] + carry[i];
+
+            matrix_t x(inputs + s*stride, rows, batch_size, false, true);
+            const matrix_t &g = steps[s]->backward(x, grad_h);
+
+            // split the gradient between the input and the state the
+            // step started from
+            for (std::size_t b = 0; b < batch_size; b++) {
+                const real_t *column = g.colptr(b);
+                real_t *to = grad_input.colptr(s*batch_size + b);
+
+                for (std::size_t i = 0; i < n_input; i++)
+                    to[i] += column[i];
+
+                std::copy(column + n_input, column + rows, carry + b*n_hidden);
+            }
+        }
+
+        dirty = std::max(dirty, T);
+        return grad_input;
+    }
+
+    parameter_list RecurrentModule::flatten_parameters() {
+        return steps.front()->flatten_parameters();
+    }
+
+    parameter_list RecurrentModule::flatten_deriv_parameters() {
+        return steps.front()->flatten_deriv_parameters();
+    }
+
+    void RecurrentModule::visit_parameters(parameter_visitor &visitor) {
+        for (auto &step : steps)
+            step->visit_parameters(visitor);
+    }
+
+    void RecurrentModule::visit_deriv_parameters(parameter_visitor &visitor) {
+        for (auto &step : steps)
+            step->visit_deriv_parameters(visitor);
+    }
+
+    void RecurrentModule::visit_modules(const module_visitor &visitor) {
+        visitor(*this);
+        for (auto &step : steps)
+            step->visit_modules(visitor);
+    }
+
+    RecurrentStreams::RecurrentStreams(module_ptr step, std::size_t capacity):
+        cell(step),
+        n_input(sequence_rows(*step)),
+        n_hidden(step->get_output_size()[0]),
+        states(n_hidden, 0),
+        n_open(0)
+    {
+        reserve(capacity);
+    }
+
+    void RecurrentStreams::reserve(std::size_t capacity) {
+        const std::size_t current = states.n_cols;
+        if (capacity <= current)
+            return;
+
+        states.resize(n_hidden, capacity);
+        active.resize(capacity, false);
+
+        // lower slots are handed out first
+        for (std::size_t slot = capacity; slot-- > current;)
+            free_slots.push_back(slot);
+    }
+
+    RecurrentStreams::stream_t RecurrentStreams::open() {
+        if (free_slots.empty())
+            reserve(std::max<std::size_t>(2*states.n_cols, 16));
+
+        const stream_t stream = free_slots.back();
+        free_slots.pop_back();
+
+        active[stream] = true;
+        states.col(stream).zeros();
+        n_open++;
+
+        return stream;
+    }
+
+    void RecurrentStreams::close(stream_t stream) {
+        check(stream);
+
+        active[stream] = false;
+        free_slots.push_back(stream);
+        n_open--;
+    }
+
+    void RecurrentStreams::check(stream_t stream) const {
+        if (stream >= active.size() || !active[stream])
+            throw std::invalid_argument("RecurrentStreams: stream is not open");
+    }
+
+    vector_t RecurrentStreams::get_state(stream_t stream) const {
+        check(stream);
+        return states.col(stream);
+    }
+
+    void RecurrentStreams::set_state(stream_t stream, const vector_t &state) {
+        check(stream);
+
+        if (state.n_elem != n_hidden)
+            throw std::invalid_argument("RecurrentStreams: state doesn't match the step");
+
+        states.col(stream) = state;
+    }
+
+    const matrix_t &RecurrentStreams::step(const std::vector<stream_t> &streams, const matrix_t &input) {
+        if (input.n_rows != n_input || input.n_cols != streams.size())
+            throw std::invalid_argument("RecurrentStreams: input has to have a column per stream");
+
+        return advance_step(streams, input, 0);
+    }
+
+    const matrix_t &RecurrentStreams::advance(const std::vector<stream_t> &streams, const matrix_t &sequence) {
+        const std::size_t count = streams.size();
+        if (count == 0 || sequence.n_rows != n_input || sequence.n_cols % count != 0)
+            throw std::invalid_argument("RecurrentStreams: sequence has to be time major over the streams");
+
+        const std::size_t T = sequence.n_cols/count;
+        outputs.set_size(n_hidden, T*count);
+
+        for (std::size_t t = 0; t < T; t++) {
+            const matrix_t &h = advance_step(streams, sequence, t*count);
+            std::copy(h.memptr(), h.memptr() + n_hidden*count, outputs.colptr(t*count));
+        }
+
+        return outputs;
+    }
+
+    const matrix_t &RecurrentStreams::advance_step(const std::vector<stream_t> &streams, const matrix_t &input, std::size_t first) {
+        const std::size_t count = streams.size();
+        const std::size_t rows = n_input + n_hidden;
+
+        stacked.set_size(rows, count);
+
+        for (std::size_t k = 0; k < count; k++) {
+            check(streams[k]);
+
+            const real_t *x = input.colptr(first + k);
+            const real_t *h = states.colptr(streams[k]);
+            real_t *to = stacked.colptr(k);
+
+            std::copy(x, x + n_input, to);
+            std::copy(h, h + n_hidden, to + n_input);
+        }
+
+        const matrix_t &next = cell->forward(stacked);
+
+        for (std::size_t k = 0; k < count; k++)
+            std::copy(next.colptr(k), next.colptr(k) + n_hidden, states.colptr(streams[k]));
+
+        return next;
+    }
+}
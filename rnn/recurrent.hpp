@@ -0,0 +1,187 @@
+//
+//  recurrent.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/13/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef recurrent_hpp
+#define recurrent_hpp
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "module.hpp"
+
+namespace gnol {
+    /*!
+     RecurrentModule unrolls a step module over a sequence and trains it
+     with backpropagation through time. The step maps the input of a
+     timestep stacked on the previous hidden state (input + hidden rows)
+     to the next hidden state (hidden rows).
+
+     A sequence of T timesteps for a batch of B samples is given time
+     major: columns t*B to t*B + B - 1 hold timestep t of every sample.
+     The output has the hidden state of each timestep laid out the same
+     way.
+
+     Every timestep up to the maximum length has its own copy of the step
+     (sharing the parameters and gradients of the first), built up front
+     along with one block holding the inputs, outputs and gradients of
+     every timestep, so neither forward nor backward allocates, whatever
+     the length of the sequence.
+
+     \code
+     const std::size_t input = 10, hidden = 20;
+
+     RecurrentModule rnn([]() {
+        return make_sequence({
+            make_module<LinearModule>(size(input + hidden, hidden)),
+            make_module<SigmoidModule>(hidden)
+        });
+     }, 500);
+
+     rnn.clear();
+     auto &states = rnn.forward(sequence);
+     rnn.backward(sequence, grad_states);
+     */
+    class RecurrentModule: public GradientModule {
+    public:
+        typedef std::shared_ptr<GradientModule> module_ptr;
+        typedef std::function<module_ptr ()> factory_t;
+    protected:
+        std::vector<module_ptr> steps;
+        std::size_t n_input, n_hidden;
+        std::size_t max_length, batch_size;
+
+        // timesteps of the last forward, and how many steps have
+        // gradients to clear
+        std::size_t length;
+        std::size_t dirty;
+
+        std::shared_ptr<real_t> block;
+        real_t *inputs, *outputs, *grad_inputs, *carry, *grad_step;
+
+        matrix_t initial;
+    public:
+        RecurrentModule(factory_t step, std::size_t max_length, std::size_t batch_size=1);
+
+        std::size_t get_max_length() const { return max_length; }
+        std::size_t get_batch_size() const { return batch_size; }
+        void set_batch_size(std::size_t batch_size);
+
+        // the step module whose parameters every timestep shares
+        GradientModule &get_step() { return *steps.front(); }
+
+        /*!
+         The state the next forward starts from (hidden rows x batch
+         size), zero unless set. For truncated backpropagation through
+         time, carry_state() after each chunk starts the next chunk where
+         the last one ended, without carrying gradients across.
+         */
+        const matrix_t &get_initial_state() const { return initial; }
+        void set_initial_state(const matrix_t &state);
+        void carry_state();
+        void reset_state() { initial.zeros(); }
+
+        bool backward_uses_input() const { return false; }
+
+        // also leaves the gradients out of the block, which then only
+        // holds the inputs and outputs of every timestep
+        void freeze();
+        void clear();
+
+        matrix_t &forward(const matrix_t &input);
+        matrix_t &backward(const matrix_t &input, const matrix_t &grad_output);
+
+        parameter_list flatten_parameters();
+        parameter_list flatten_deriv_parameters();
+
+        // visits the (tied) parameters of every timestep, so an arena
+        // built on the module moves all of them
+        void visit_parameters(parameter_visitor &visitor);
+        void visit_deriv_parameters(parameter_visitor &visitor);
+        void visit_modules(const module_visitor &visitor);
+    protected:
+        RecurrentModule(module_ptr first, factory_t step, std::size_t max_length, std::size_t batch_size);
+
+        void allocate();
+    };
+
+    /*!
+     RecurrentStreams runs a step module over many independent streams
+     that each arrive one input at a time (e.g. online scoring), without
+     rerunning anything a stream has already seen. The state of every
+     open stream is one column of a single matrix; a step gathers the
+     inputs and states of the streams given to it, runs the step module
+     once over all of them as a batch, and scatters the new states back.
+     The work per input is constant, however long a stream has run.
+
+     The step module follows the same convention as for RecurrentModule,
+     and is typically tied to the step of a trained one. A stream can
+     appear at most once in each call.
+
+     \code
+     auto step = factory();
+     tie_parameters(*step, rnn.get_step());
+
+     RecurrentStreams streams(step);
+     auto a = streams.open(), b = streams.open();
+     auto &states = streams.step({a, b}, inputs);
+     */
+    class RecurrentStreams {
+    public:
+        typedef std::shared_ptr<GradientModule> module_ptr;
+        typedef std::size_t stream_t;
+    protected:
+        module_ptr cell;
+        std::size_t n_input, n_hidden;
+
+        // one column per slot, open or not
+        matrix_t states;
+        std::vector<bool> active;
+        std::vector<stream_t> free_slots;
+        std::size_t n_open;
+
+        matrix_t stacked, outputs;
+    public:
+        RecurrentStreams(module_ptr step, std::size_t capacity=0);
+
+        // makes room for capacity streams without growing later
+        void reserve(std::size_t capacity);
+
+        // a new stream starting from the zero state
+        stream_t open();
+        void close(stream_t stream);
+
+        std::size_t size() const { return n_open; }
+        std::size_t capacity() const { return states.n_cols; }
+
+        // a copy of the state of a stream, which can be restored later
+        // (to the same or another stream)
+        vector_t get_state(stream_t stream) const;
+        void set_state(stream_t stream, const vector_t &state);
+
+        /*!
+         Advances each of streams by the matching column of input,
+         returning the new states (one column per stream).
+         */
+        const matrix_t &step(const std::vector<stream_t> &streams, const matrix_t &input);
+
+        /*!
+         Advances streams by a chunk given time major, as for
+         RecurrentModule, returning the states after every timestep laid
+         out the same way.
+         */
+        const matrix_t &advance(const std::vector<stream_t> &streams, const matrix_t &sequence);
+    protected:
+        void check(stream_t stream) const;
+
+        // advances streams by the columns of input starting at first
+        const matrix_t &advance_step(const std::vector<stream_t> &streams, const matrix_t &input, std::size_t first);
+    };
+}
+
+#endif /* recurrent_hpp */
@@ -15,8 +15,23 @@
 #include "check_gradient.hpp"
 #include "linear.hpp"
 #include "sequence.hpp"
+#include "thread_pool.hpp"
 #include "concat.hpp"
 #include "reshape.hpp"
+#include "kernels.hpp"
 #include "activation.hpp"
+#include "convolve.hpp"
+#include "arena.hpp"
+#include "optimizer.hpp"
+#include "trainer.hpp"
+#include "tree.hpp"
+#include "recurrent.hpp"
+#include "cell.hpp"
+#include "model.hpp"
+#include "dataset.hpp"
+#include "context.hpp"
+#include "server.hpp"
+#include "fusion.hpp"
+#include "static.hpp"
 
 #endif
@@ -8,10 +8,78 @@
 
 #include "sequence.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+
 namespace gnol {
+    namespace {
+        // buffers in the pool start on 64 byte boundaries
+        const std::size_t pool_alignment = 64/sizeof(real_t);
+        
+        std::size_t align(std::size_t length) {
+            return (length + pool_alignment - 1)/pool_alignment*pool_alignment;
+        }
+        
+        void output_shape(GradientModule &mod, std::size_t batch_size, uword &rows, uword &cols) {
+            auto size = mod.get_output_size();
+            rows = size[0];
+            cols = size.dims() == 1 ? batch_size : size[1];
+        }
+        
+        // the steps (inclusive) between which a buffer has to keep its values
+        struct lifetime {
+            std::size_t first, last;
+            std::size_t length;
+        };
+        
+        /*!
+         Greedy interval coloring. In order of first use, each lifetime
+         takes the smallest free buffer big enough to hold it, otherwise
+         grows the biggest free buffer, otherwise starts a new one. Returns
+         the buffer of each lifetime and fills in the length of each
+         buffer.
+         */
+        std::vector<std::size_t> assign_buffers(const std::vector<lifetime> &lifetimes,
+                                                std::vector<std::size_t> &lengths)
+        {
+            std::vector<std::size_t> assigned(lifetimes.size());
+            std::vector<std::size_t> free_after;
+            
+            for (std::size_t k = 0; k < lifetimes.size(); k++) {
+                const lifetime &lt = lifetimes[k];
+                
+                std::size_t fit = lengths.size(), grow = lengths.size();
+                for (std::size_t b = 0; b < lengths.size(); b++) {
+                    if (free_after[b] >= lt.first)
+                        continue;
+                    
+                    if (lengths[b] >= lt.length) {
+                        if (fit == lengths.size() || lengths[b] < lengths[fit])
+                            fit = b;
+                    } else if (grow == lengths.size() || lengths[b] > lengths[grow]) {
+                        grow = b;
+                    }
+                }
+                
+                std::size_t b = fit != lengths.size() ? fit : grow;
+                if (b == lengths.size()) {
+                    lengths.push_back(0);
+                    free_after.push_back(0);
+                }
+                
+                lengths[b] = std::max(lengths[b], lt.length);
+                free_after[b] = lt.last;
+                assigned[k] = b;
+            }
+            
+            return assigned;
+        }
+    }
+
     SequenceModule::SequenceModule(list_t modules):
         modules(modules),
-        GradientModule(modules.front()->get_input_size(), modules.back()->get_output_size()) {}
+        GradientModule(modules.front()->get_input_size(), modules.back()->get_output_size()),
+        labels(modules.size()) {}
 
 
     SequenceModule::SequenceModule(name_list_t modules):
@@ -21,6 +89,7 @@ namespace gnol {
         for (auto named_module : modules) {
             this->modules.push_back(named_module.second);
             names[named_module.first] = named_module.second;
+            labels.push_back(named_module.first);
         }
     }
 
@@ -31,40 +100,199 @@ namespace gnol {
             mod->clear();
     }
 
+    void SequenceModule::replace(std::size_t first, std::size_t count, ptr_t module) {
+        if (count == 0 || first + count > modules.size())
+            throw std::out_of_range("SequenceModule: no children to replace there");
+        
+        const std::string name = labels[first + count - 1];
+        for (std::size_t i = first; i < first + count; i++) {
+            if (!labels[i].empty())
+                names.erase(labels[i]);
+        }
+        
+        modules.erase(modules.begin() + first, modules.begin() + first + count);
+        modules.insert(modules.begin() + first, module);
+        labels.erase(labels.begin() + first, labels.begin() + first + count);
+        labels.insert(labels.begin() + first, name);
+        
+        if (!name.empty())
+            names[name] = module;
+        
+        if (is_planned())
+            plan(current_plan.batch_size);
+    }
+
+    void SequenceModule::freeze() {
+        for (auto mod : modules)
+            mod->freeze();
+        
+        // without backward nothing in the chain reads an output once the
+        // next child has run, so every child that can runs in place,
+        // unless the output is also read from outside (e.g. shared as the
+        // target of a criterion)
+        for (std::size_t i = 1; i < modules.size(); i++) {
+            if (modules[i]->supports_inplace() && modules[i-1]->get_output().use_count() == 1)
+                modules[i]->set_inplace(true);
+        }
+        
+        GradientModule::freeze();
+        
+        if (is_planned())
+            plan(current_plan.batch_size);
+    }
+
+    void SequenceModule::enable_inplace() {
+        // the first module reads the caller's input, which is never
+        // overwritten
+        for (std::size_t i = 1; i < modules.size(); i++) {
+            if (modules[i]->supports_inplace() &&
+                !modules[i-1]->backward_uses_output() &&
+                modules[i-1]->get_output().use_count() == 1)
+            {
+                modules[i]->set_inplace(true);
+            }
+        }
+        
+        if (is_planned())
+            plan(current_plan.batch_size);
+    }
+
+    const memory_plan &SequenceModule::plan(std::size_t batch_size) {
+        // forward of child i runs at step i and its backward at step
+        // 2n-1-i; the last output is handed back to the caller, so it
+        // outlives both
+        const std::size_t n = modules.size();
+        auto backward_step = [n](std::size_t i) { return 2*n - 1 - i; };
+        
+        memory_plan result;
+        result.batch_size = batch_size;
+        
+        std::vector<lifetime> lifetimes;
+        
+        // (child, lifetime) of every output to bind into the pool
+        std::vector<std::pair<std::size_t, std::size_t>> bindings;
+        
+        // whether the current child writes over the caller's input, which
+        // isn't part of the pool
+        bool outside = false;
+        
+        for (std::size_t i = 0; i < n; i++) {
+            uword rows, cols;
+            output_shape(*modules[i], batch_size, rows, cols);
+            result.naive_bytes += rows*cols*sizeof(real_t);
+            
+            // frozen, an output is only read by the next forward, so
+            // the outputs take turns in two buffers; one shared outside
+            // the chain can be read at any point, so it's kept throughout
+            std::size_t last = 2*n;
+            if (i + 1 < n && modules[i]->get_output().use_count() == 1) {
+                last = i + 1;
+                if (!frozen && modules[i + 1]->backward_uses_input())
+                    last = backward_step(i + 1);
+            }
+            
+            if (!frozen && modules[i]->backward_uses_output())
+                last = std::max(last, backward_step(i));
+            
+            // an in place child shares the buffer of the child before it,
+            // which then has to live as long as either needs it
+            if (modules[i]->is_inplace()) {
+                if (i == 0 || outside) {
+                    outside = true;
+                    continue;
+                }
+                
+                lifetimes.back().last = std::max(lifetimes.back().last, last);
+            } else {
+                outside = false;
+                lifetimes.push_back({i, last, rows*cols});
+            }
+            
+            bindings.push_back({i, lifetimes.size() - 1});
+        }
+        
+        // the sequence's own copy of the last output
+        uword rows, cols;
+        output_shape(*modules.back(), batch_size, rows, cols);
+        result.naive_bytes += rows*cols*sizeof(real_t);
+        
+        std::vector<std::size_t> lengths;
+        auto assigned = assign_buffers(lifetimes, lengths);
+        
+        std::vector<std::size_t> offsets(lengths.size());
+        std::size_t total = 0;
+        for (std::size_t b = 0; b < lengths.size(); b++) {
+            offsets[b] = total;
+            total += align(lengths[b]);
+        }
+        
+        // the old pool is kept until every output has moved off of it
+        auto memory = allocate_aligned(total);
+        for (auto &binding : bindings) {
+            output_shape(*modules[binding.first], batch_size, rows, cols);
+            real_t *buffer = memory.get() + offsets[assigned[binding.second]];
+            modules[binding.first]->get_output().rebind(buffer, rows, cols, false);
+        }
+        
+        matrix_t &last = *modules.back()->get_output();
+        output.rebind(last.memptr(), last.n_rows, last.n_cols, false);
+        pool = memory;
+        
+        result.planned_bytes = total*sizeof(real_t);
+        result.buffers = lengths.size();
+        current_plan = result;
+        
+        return current_plan;
+    }
+
     matrix_t &SequenceModule::forward(const matrix_t &input) {
-        *output = input;
+        // a frozen sequence always runs planned
+        if ((frozen && !is_planned()) || (is_planned() && input.n_cols != current_plan.batch_size))
+            plan(input.n_cols);
+        
+        // each module reads the previous module's output directly
+        const matrix_t *current = &input;
         for (auto mod : modules)
-            *output = mod->forward(*output);
+            current = &mod->forward(*current);
+        
+        if (!is_planned()) {
+            *output = *current;
+        } else if (output->memptr() != current->memptr() ||
+                   output->n_rows != current->n_rows ||
+                   output->n_cols != current->n_cols)
+        {
+            // the last child moved its output (e.g. it resized it), so
+            // follow it rather than copying
+            output.rebind(const_cast<real_t *>(current->memptr()),
+                          current->n_rows, current->n_cols, false);
+        }
         
         return *output;
     }
 
     matrix_t &SequenceModule::backward(const matrix_t &input, const matrix_t &grad_output) {
-        matrix_t ginput = grad_output;
+        // gradients are passed along by reference, like the outputs in
+        // forward
+        const matrix_t *grad = &grad_output;
         
         // go until the first module (need to handle that separately
-        auto last = modules.rend();
-        --last;
+        for (std::size_t i = modules.size() - 1; i > 0; i--)
+            grad = &modules[i]->backward(*modules[i - 1]->get_output(), *grad);
         
-        for (auto pos = modules.rbegin(); pos != last; pos++) {
-            auto prev = pos;
-            ++prev;
-            
-            ginput = (*pos)->backward(*(*prev)->get_output(), ginput);
-        }
-        ginput = modules.front()->backward(input, ginput);
+        grad = &modules.front()->backward(input, *grad);
         
-        grad_input += ginput;
+        match_grad_input(input);
+        grad_input += *grad;
         return grad_input;
     }
 
     parameter_list SequenceModule::flatten_parameters() {
         parameter_list params;
-        std::insert_iterator<parameter_list> insert(params, params.end());
         
+        // splice rather than copy so the nodes are only allocated once
         for (auto mod : modules) {
             auto mod_params = mod->flatten_parameters();
-            std::copy(mod_params.begin(), mod_params.end(), insert);
+            params.splice(params.end(), mod_params);
         }
         
         return params;
@@ -72,16 +300,32 @@ namespace gnol {
 
     parameter_list SequenceModule::flatten_deriv_parameters() {
         parameter_list params;
-        std::insert_iterator<parameter_list> insert(params, params.end());
         
+        // splice rather than copy so the nodes are only allocated once
         for (auto mod : modules) {
             auto mod_params = mod->flatten_deriv_parameters();
-            std::copy(mod_params.begin(), mod_params.end(), insert);
+            params.splice(params.end(), mod_params);
         }
         
         return params;
     }
 
+    void SequenceModule::visit_parameters(parameter_visitor &visitor) {
+        for (auto mod : modules)
+            mod->visit_parameters(visitor);
+    }
+
+    void SequenceModule::visit_deriv_parameters(parameter_visitor &visitor) {
+        for (auto mod : modules)
+            mod->visit_deriv_parameters(visitor);
+    }
+
+    void SequenceModule::visit_modules(const module_visitor &visitor) {
+        visitor(*this);
+        for (auto mod : modules)
+            mod->visit_modules(visitor);
+    }
+
     std::shared_ptr<SequenceModule>
     make_sequence(std::initializer_list<SequenceModule::ptr_t> modules) {
         return std::shared_ptr<SequenceModule>(new SequenceModule(modules));
@@ -10,10 +10,37 @@
 #define __rnn__sequence__
 
 #include <map>
+#include <ostream>
+#include <string>
+#include <vector>
 
 #include "module.hpp"
 
 namespace gnol {
+    /*!
+     Memory used by the outputs of a SequenceModule's children for a given
+     batch size. naive_bytes is what they take when each child keeps its
+     own output (plus the sequence's copy of the last one), planned_bytes
+     is the size of the shared pool they are packed into instead.
+     */
+    struct memory_plan {
+        std::size_t batch_size;
+        std::size_t naive_bytes;
+        std::size_t planned_bytes;
+        std::size_t buffers;
+        
+        memory_plan():
+            batch_size(0), naive_bytes(0), planned_bytes(0), buffers(0) {}
+        
+        friend std::ostream &operator <<(std::ostream &os, const memory_plan &plan) {
+            os << "batch " << plan.batch_size << ": "
+               << plan.naive_bytes << " bytes naive, "
+               << plan.planned_bytes << " bytes planned in "
+               << plan.buffers << " buffers";
+            return os;
+        }
+    };
+    
     class SequenceModule: public GradientModule {
     public:
         typedef std::shared_ptr<GradientModule> ptr_t;
@@ -23,6 +50,12 @@ namespace gnol {
     protected:
         list_t modules;
         std::map<std::string, ptr_t> names;
+        
+        // name of each child, in order (empty if not named)
+        std::vector<std::string> labels;
+        
+        memory_plan current_plan;
+        std::shared_ptr<real_t> pool;
     public:
         SequenceModule(list_t modules);
         SequenceModule(name_list_t modules);
@@ -30,11 +63,61 @@ namespace gnol {
         ptr_t operator [](const std::string &name) { return names[name]; }
         ptr_t operator [](std::size_t index) { return modules[index]; }
         
+        std::size_t size() const { return modules.size(); }
+        const std::string &get_name(std::size_t index) const { return labels[index]; }
+        
+        /*!
+         Replaces count children, starting at first, with module, which
+         takes over the name of the last of them (whose output it
+         produces). The outputs are replanned if planned.
+         */
+        void replace(std::size_t first, std::size_t count, ptr_t module);
+        
         void clear();
+        
+        /*!
+         Freezes every child and runs every child that supports it in
+         place. The outputs are then planned (on the first forward, if
+         not already) into two buffers used in turn, so beyond the
+         weights a frozen sequence holds little more than its two largest
+         outputs.
+         */
+        void freeze();
+        
+        /*!
+         Lets every child that supports it run in place when the output of
+         the module before it is not needed by that module's backward.
+         The earlier module's output then holds the later module's result,
+         so this should not be used if something outside the sequence
+         reads that output.
+         */
+        void enable_inplace();
+        
+        /*!
+         Packs the outputs of the children into a shared pool of buffers.
+         Outputs whose lifetimes (from the forward that writes them to the
+         last forward or backward that reads them) don't overlap share a
+         buffer, and the sequence's output becomes a view of the last
+         child's output rather than a copy of it.
+         
+         Once planned, forward replans by itself when the batch size
+         changes. Planning discards the current outputs, and outputs that
+         backward doesn't need are overwritten during forward, so they
+         can't be read from outside the sequence afterwards.
+         */
+        const memory_plan &plan(std::size_t batch_size);
+        const memory_plan &get_plan() const { return current_plan; }
+        bool is_planned() const { return bool(pool); }
+        
+        bool backward_uses_input() const { return modules.front()->backward_uses_input(); }
+        
         matrix_t &forward(const matrix_t &input);
         matrix_t &backward(const matrix_t &input, const matrix_t &grad_output);
         parameter_list flatten_parameters();
         parameter_list flatten_deriv_parameters();
+        void visit_parameters(parameter_visitor &visitor);
+        void visit_deriv_parameters(parameter_visitor &visitor);
+        void visit_modules(const module_visitor &visitor);
     };
     
     std::shared_ptr<SequenceModule>
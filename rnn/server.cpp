@@ -0,0 +1,189 @@
+//
+//  server.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/17/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "server.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace gnol {
+    BatchingServer::BatchingServer(shared_model &model, batching_policy policy):
+        model(model),
+        policy(policy),
+        // batches only ever run forward
+        context(model.acquire(execution_context::inference)),
+        incoming(nullptr),
+        waiting(false),
+        stopping(false),
+        batches(0),
+        served(0)
+    {
+        if (policy.max_batch == 0)
+            throw std::invalid_argument("BatchingServer: batches have to hold at least one request");
+
+        worker = std::thread(&BatchingServer::run, this);
+    }
+
+    BatchingServer::~BatchingServer() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+
+        wake.notify_one();
+        worker.join();
+    }
+
+    std::future<vector_t> BatchingServer::submit(const vector_t &input) {
+        // samples are single columns, so only the rows can be checked
+        auto input_size = model.get_model().get_input_size();
+        if (input_size.dims() == 1 && input_size[0] != 0 && input.n_elem != input_size[0])
+            throw std::invalid_argument("BatchingServer: input doesn't match the model");
+
+        std::unique_ptr<request> r(new request);
+        r->input = input;
+        r->arrival = clock_t::now();
+        std::future<vector_t> result = r->result.get_future();
+
+        request *node = r.release();
+        node->next = incoming.load(std::memory_order_relaxed);
+        while (!incoming.compare_exchange_weak(node->next, node)) {}
+
+        // the serving thread sets waiting before it looks at incoming one
+        // last time, so either it sees the request or it gets woken
+        if (waiting) {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            wake.notify_one();
+        }
+
+        return result;
+    }
+
+    void BatchingServer::take(request *&head, request *&tail, std::size_t &count) {
+        request *list = incoming.exchange(nullptr);
+        if (!list)
+            return;
+
+        // the list is newest first, so its head ends up last
+        request *newest = list;
+        request *oldest = nullptr;
+
+        while (list) {
+            request *next = list->next;
+            list->next = oldest;
+            oldest = list;
+            list = next;
+            count++;
+        }
+
+        if (tail)
+            tail->next = oldest;
+        else
+            head = oldest;
+
+        tail = newest;
+    }
+
+    void BatchingServer::sleep(bool timed, clock_t::time_point deadline) {
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        waiting = true;
+
+        if (!incoming && !stopping) {
+            if (timed)
+                wake.wait_until(lock, deadline);
+            else
+                wake.wait(lock);
+        }
+
+        waiting = false;
+    }
+
+    void BatchingServer::run() {
+        request *head = nullptr, *tail = nullptr;
+        std::size_t count = 0;
+
+        for (;;) {
+            take(head, tail, count);
+
+            if (count == 0) {
+                if (stopping)
+                    return;
+
+                sleep(false, clock_t::time_point());
+                continue;
+            }
+
+            // wait for the batch to fill, up to the oldest request's
+            // deadline (not at all once stopping)
+            const clock_t::time_point deadline = head->arrival + policy.max_delay;
+            while (count < policy.max_batch && !stopping && clock_t::now() < deadline) {
+                sleep(true, deadline);
+                take(head, tail, count);
+            }
+
+            const std::size_t n = std::min(count, policy.max_batch);
+            request *first = head, *last = head;
+            for (std::size_t i = 1; i < n; i++)
+                last = last->next;
+
+            head = last->next;
+            last->next = nullptr;
+            if (!head)
+                tail = nullptr;
+            count -= n;
+
+            run_batch(first, n);
+        }
+    }
+
+    void BatchingServer::run_batch(request *first, std::size_t n) {
+        // submit() can only check the size against models taking single
+        // columns, so a request that doesn't match the first of its batch
+        // fails on its own rather than taking the batch down with it
+        const std::size_t rows = first->input.n_elem;
+        std::size_t valid = 0;
+        for (request *r = first; r; r = r->next)
+            valid += r->input.n_elem == rows;
+
+        const matrix_t *output = nullptr;
+        std::exception_ptr error;
+
+        try {
+            inputs.set_size(rows, valid);
+
+            std::size_t j = 0;
+            for (request *r = first; r; r = r->next) {
+                if (r->input.n_elem == rows)
+                    inputs.col(j++) = r->input;
+            }
+
+            output = &context->forward(inputs);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::size_t j = 0;
+        while (first) {
+            std::unique_ptr<request> r(first);
+            first = first->next;
+
+            if (r->input.n_elem != rows) {
+                r->result.set_exception(std::make_exception_ptr(
+                    std::invalid_argument("BatchingServer: input doesn't match the rest of its batch")));
+            } else if (error) {
+                r->result.set_exception(error);
+            } else {
+                r->result.set_value(vector_t(output->col(j++)));
+            }
+        }
+
+        batches++;
+        served += n;
+    }
+}
@@ -0,0 +1,128 @@
+//
+//  server.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/17/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef server_hpp
+#define server_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "context.hpp"
+
+namespace gnol {
+    /*!
+     When a batch is run: as soon as it has max_batch requests, or once
+     the oldest request in it has waited max_delay.
+     */
+    struct batching_policy {
+        std::size_t max_batch;
+        std::chrono::microseconds max_delay;
+
+        batching_policy(std::size_t max_batch=32,
+                        std::chrono::microseconds max_delay=std::chrono::microseconds(1000)):
+            max_batch(max_batch), max_delay(max_delay) {}
+    };
+
+    /*!
+     BatchingServer serves single samples from any number of threads by
+     running them through the model in batches, one column per request,
+     so callers pay for one matrix product per batch rather than one
+     matrix-vector product each. A request waits at most about max_delay
+     for others to batch with (less if the batch fills up first).
+
+     Submitting never blocks: requests are pushed onto a lock-free list
+     that the serving thread takes over in one go, and the only lock is
+     taken to wake that thread when it's asleep. Batches run in an
+     inference execution_context of the model, leased for as long as the
+     server runs, so other threads can still use the model directly.
+
+     \code
+     shared_model model([]() {
+        return make_sequence({
+           make_module<LinearModule>(size(10, 5)),
+           make_module<SigmoidModule>(5)
+        });
+     });
+
+     BatchingServer server(model, batching_policy(64, std::chrono::microseconds(500)));
+
+     // from any thread
+     std::future<vector_t> encoding = server.submit(input);
+     */
+    class BatchingServer {
+    public:
+        typedef std::chrono::steady_clock clock_t;
+    protected:
+        struct request {
+            vector_t input;
+            std::promise<vector_t> result;
+            clock_t::time_point arrival;
+            request *next;
+        };
+
+        shared_model &model;
+        batching_policy policy;
+
+        // used by the serving thread only
+        shared_model::lease_t context;
+        matrix_t inputs;
+
+        // newest first; the serving thread swaps the whole list out
+        std::atomic<request *> incoming;
+
+        // set while the serving thread is (about to be) asleep, so
+        // submit() only takes the lock when it has to
+        std::atomic<bool> waiting;
+        std::atomic<bool> stopping;
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+
+        std::atomic<std::size_t> batches, served;
+        std::thread worker;
+    public:
+        BatchingServer(shared_model &model, batching_policy policy=batching_policy());
+
+        // serves whatever was submitted before returning
+        ~BatchingServer();
+
+        BatchingServer(const BatchingServer &) = delete;
+        BatchingServer &operator =(const BatchingServer &) = delete;
+
+        const batching_policy &get_policy() const { return policy; }
+
+        // number of batches run and requests served so far
+        std::size_t get_batches() const { return batches; }
+        std::size_t get_served() const { return served; }
+
+        /*!
+         Queues input (a single sample) for the model. The future gets its
+         output, or the exception forward threw for its batch. Throws
+         std::invalid_argument if input doesn't fit the model.
+         */
+        std::future<vector_t> submit(const vector_t &input);
+    protected:
+        void run();
+
+        // waits for a submit() (or, if timed, for deadline)
+        void sleep(bool timed, clock_t::time_point deadline);
+
+        // moves the incoming requests, oldest first, to the end of the
+        // list running from head to tail
+        void take(request *&head, request *&tail, std::size_t &count);
+
+        // runs the list starting at first as one batch, completing and
+        // freeing its requests
+        void run_batch(request *first, std::size_t n);
+    };
+}
+
+#endif /* server_hpp */
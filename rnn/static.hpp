@@ -0,0 +1,332 @@
+//
+//  static.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/17/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef static_hpp
+#define static_hpp
+
+#include <stdexcept>
+
+#include "module.hpp"
+#include "activation.hpp"
+
+namespace gnol {
+    /*!
+     Storage for a Rows x Cols matrix: a fixed size Armadillo matrix,
+     held inside the object (no heap, sizes known to the compiler), or a
+     regular one when Cols is 0 (only known at runtime).
+     */
+    template <std::size_t Rows, std::size_t Cols>
+    struct static_matrix {
+        typedef typename matrix_t::template fixed<Rows, Cols> type;
+    };
+
+    template <std::size_t Rows>
+    struct static_matrix<Rows, 0> {
+        typedef matrix_t type;
+    };
+
+    /*!
+     Layers of a StaticSequence. A layer has its sizes as input_rows and
+     output_rows, and forward and backward templated on the matrix types,
+     so they compile down to the exact shapes used. As everywhere else,
+     backward accumulates into grad_input.
+
+     Like the parameters of a ParameterizedModule, those of a layer are
+     variables, so arenas, tie_parameters and mapped models can move
+     them; they start out as views of fixed size storage inside the
+     layer, so until then nothing is allocated for them. Activations
+     reuse the Op and Gradient structs of the regular activation modules.
+     */
+    template <std::size_t In, std::size_t Out>
+    struct StaticLinear {
+        static const std::size_t input_rows = In, output_rows = Out;
+    protected:
+        typename matrix_t::template fixed<In, Out> weight_storage, grad_weight_storage;
+        typename vector_t::template fixed<Out> bias_storage, grad_bias_storage;
+    public:
+        variable<matrix_t> weight, grad_weight;
+        variable<vector_t> bias, grad_bias;
+
+        StaticLinear():
+            weight(matrix_t()), grad_weight(matrix_t()),
+            bias(vector_t()), grad_bias(vector_t())
+        {
+            weight.rebind(weight_storage.memptr(), In, Out, true);
+            grad_weight.rebind(grad_weight_storage.memptr(), In, Out, true);
+            bias.rebind(bias_storage.memptr(), Out, 1, true);
+            grad_bias.rebind(grad_bias_storage.memptr(), Out, 1, true);
+
+            weight->randu();
+            bias->randu();
+            clear();
+        }
+
+        // the variables are views of the layer's own storage
+        StaticLinear(const StaticLinear &) = delete;
+        StaticLinear &operator =(const StaticLinear &) = delete;
+
+        template <typename InputT, typename OutputT>
+        void forward(const InputT &input, OutputT &output) {
+            output = (*weight).t()*input;
+            output.each_col() += *bias;
+        }
+
+        template <typename InputT, typename OutputT, typename GradOutputT, typename GradInputT>
+        void backward(const InputT &input, const OutputT &output, const GradOutputT &grad_output, GradInputT &grad_input) {
+            *grad_weight += input*grad_output.t();
+            *grad_bias += sum(grad_output, 1);
+            grad_input += (*weight)*grad_output;
+        }
+
+        void clear() {
+            grad_weight->zeros();
+            grad_bias->zeros();
+        }
+
+        void flatten(parameter_list &params) {
+            params.push_back(boost::make_iterator_range(weight->begin(), weight->end()));
+            params.push_back(boost::make_iterator_range(bias->begin(), bias->end()));
+        }
+
+        void flatten_deriv(parameter_list &params) {
+            params.push_back(boost::make_iterator_range(grad_weight->begin(), grad_weight->end()));
+            params.push_back(boost::make_iterator_range(grad_bias->begin(), grad_bias->end()));
+        }
+
+        void visit(parameter_visitor &visitor) {
+            visitor(weight);
+            visitor(bias);
+        }
+
+        void visit_deriv(parameter_visitor &visitor) {
+            visitor(grad_weight);
+            visitor(grad_bias);
+        }
+    };
+
+    template <typename OpT, typename GradOpT, std::size_t N>
+    struct StaticActivation {
+        static const std::size_t input_rows = N, output_rows = N;
+
+        OpT op;
+        GradOpT grad;
+
+        template <typename InputT, typename OutputT>
+        void forward(const InputT &input, OutputT &output) {
+            output.set_size(input.n_rows, input.n_cols);
+            op(input.memptr(), output.memptr(), input.n_elem);
+        }
+
+        template <typename InputT, typename OutputT, typename GradOutputT, typename GradInputT>
+        void backward(const InputT &input, const OutputT &output, const GradOutputT &grad_output, GradInputT &grad_input) {
+            grad(output.memptr(), grad_output.memptr(), grad_input.memptr(), output.n_elem);
+        }
+
+        void clear() {}
+        void flatten(parameter_list &params) {}
+        void flatten_deriv(parameter_list &params) {}
+        void visit(parameter_visitor &visitor) {}
+        void visit_deriv(parameter_visitor &visitor) {}
+    };
+
+    template <std::size_t N> using StaticSigmoid = StaticActivation<SigmoidOp, SigmoidGradient, N>;
+    template <std::size_t N> using StaticTanh = StaticActivation<TanhOp, TanhGradient, N>;
+    template <std::size_t N> using StaticReLU = StaticActivation<ReLUOp, ReLUGradient, N>;
+    template <std::size_t N> using StaticSoftplus = StaticActivation<SoftplusOp, SoftplusGradient, N>;
+
+    /*!
+     The layers of a StaticSequence, each followed by the buffer holding
+     its output (and the gradient of that output), nested one inside the
+     next so every call between them is resolved at compile time.
+     */
+    template <std::size_t Batch, typename...Layers>
+    struct static_chain;
+
+    template <std::size_t Batch, typename Layer>
+    struct static_chain<Batch, Layer> {
+        static const std::size_t input_rows = Layer::input_rows, output_rows = Layer::output_rows;
+
+        typedef Layer layer_t;
+        typedef typename static_matrix<Layer::output_rows, Batch>::type output_t;
+
+        Layer layer;
+        output_t output;
+
+        template <typename InputT>
+        const output_t &forward(const InputT &input) {
+            layer.forward(input, output);
+            return output;
+        }
+
+        template <typename InputT, typename GradOutputT, typename GradInputT>
+        void backward(const InputT &input, const GradOutputT &grad_output, GradInputT &grad_input) {
+            layer.backward(input, output, grad_output, grad_input);
+        }
+
+        void clear() { layer.clear(); }
+        void flatten(parameter_list &params) { layer.flatten(params); }
+        void flatten_deriv(parameter_list &params) { layer.flatten_deriv(params); }
+        void visit(parameter_visitor &visitor) { layer.visit(visitor); }
+        void visit_deriv(parameter_visitor &visitor) { layer.visit_deriv(visitor); }
+    };
+
+    template <std::size_t Batch, typename Layer, typename Next, typename...Rest>
+    struct static_chain<Batch, Layer, Next, Rest...> {
+        static_assert(Layer::output_rows == Next::input_rows, "StaticSequence: sizes of consecutive layers don't match");
+
+        typedef Layer layer_t;
+        typedef static_chain<Batch, Next, Rest...> rest_t;
+
+        static const std::size_t input_rows = Layer::input_rows, output_rows = rest_t::output_rows;
+
+        typedef typename static_matrix<Layer::output_rows, Batch>::type hidden_t;
+        typedef typename rest_t::output_t output_t;
+
+        Layer layer;
+        hidden_t hidden, grad_hidden;
+        rest_t rest;
+
+        template <typename InputT>
+        const output_t &forward(const InputT &input) {
+            layer.forward(input, hidden);
+            return rest.forward(hidden);
+        }
+
+        template <typename InputT, typename GradOutputT, typename GradInputT>
+        void backward(const InputT &input, const GradOutputT &grad_output, GradInputT &grad_input) {
+            grad_hidden.set_size(hidden.n_rows, hidden.n_cols);
+            grad_hidden.zeros();
+            rest.backward(hidden, grad_output, grad_hidden);
+            layer.backward(input, hidden, grad_hidden, grad_input);
+        }
+
+        void clear() {
+            layer.clear();
+            rest.clear();
+        }
+
+        void flatten(parameter_list &params) {
+            layer.flatten(params);
+            rest.flatten(params);
+        }
+
+        void flatten_deriv(parameter_list &params) {
+            layer.flatten_deriv(params);
+            rest.flatten_deriv(params);
+        }
+
+        void visit(parameter_visitor &visitor) {
+            layer.visit(visitor);
+            rest.visit(visitor);
+        }
+
+        void visit_deriv(parameter_visitor &visitor) {
+            layer.visit_deriv(visitor);
+            rest.visit_deriv(visitor);
+        }
+    };
+
+    template <std::size_t I, typename ChainT>
+    struct static_layer {
+        typedef typename static_layer<I - 1, typename ChainT::rest_t>::type type;
+        static type &get(ChainT &chain) { return static_layer<I - 1, typename ChainT::rest_t>::get(chain.rest); }
+    };
+
+    template <typename ChainT>
+    struct static_layer<0, ChainT> {
+        typedef typename ChainT::layer_t type;
+        static type &get(ChainT &chain) { return chain.layer; }
+    };
+
+    /*!
+     StaticSequence is a sequence whose layers (and their sizes) are
+     template parameters, so the whole of forward and backward is inlined
+     into one function, with no virtual calls or shared pointers between
+     layers. With a batch size given, every buffer and parameter is a
+     fixed size matrix inside the object, so nothing is allocated after
+     construction and the products are over shapes known at compile
+     time. That pays off for small layers, where dispatch and allocation
+     otherwise cost as much as the arithmetic; for big ones, use a
+     SequenceModule.
+
+     A Batch of 0 takes any number of columns, with regular matrices as
+     buffers. The sequence is itself a GradientModule, so it can be used
+     anywhere one is (at the cost of the one virtual call into it),
+     including in containers, shared_model and optimizers. Parameters
+     moved elsewhere (e.g. into a parameter_arena) are read through
+     views, like those of any other module.
+
+     \code
+     // the encoder of the autoencoder, for batches of 16
+     StaticSequence<16, StaticLinear<10, 5>, StaticSigmoid<5>> encoder;
+     auto &output = encoder.forward(input);
+     */
+    template <std::size_t Batch, typename...Layers>
+    class StaticSequence final: public GradientModule {
+    public:
+        typedef static_chain<Batch, Layers...> chain_t;
+    protected:
+        chain_t chain;
+    public:
+        StaticSequence():
+            GradientModule(std::size_t(chain_t::input_rows), std::size_t(chain_t::output_rows)) {}
+
+        template <std::size_t I>
+        typename static_layer<I, chain_t>::type &get_layer() { return static_layer<I, chain_t>::get(chain); }
+
+        matrix_t &forward(const matrix_t &input) {
+            check(input);
+
+            auto &result = chain.forward(input);
+
+            // keep get_output() in step for containers reading it
+            if (output->memptr() != result.memptr() ||
+                output->n_rows != result.n_rows ||
+                output->n_cols != result.n_cols)
+            {
+                output.rebind(const_cast<real_t *>(result.memptr()), result.n_rows, result.n_cols, false);
+            }
+
+            return *output;
+        }
+
+        matrix_t &backward(const matrix_t &input, const matrix_t &grad_output) {
+            check(input);
+            match_grad_input(input);
+            chain.backward(input, grad_output, grad_input);
+            return grad_input;
+        }
+
+        void clear() {
+            grad_input.zeros();
+            chain.clear();
+        }
+
+        parameter_list flatten_parameters() {
+            parameter_list params;
+            chain.flatten(params);
+            return params;
+        }
+
+        parameter_list flatten_deriv_parameters() {
+            parameter_list params;
+            chain.flatten_deriv(params);
+            return params;
+        }
+
+        void visit_parameters(parameter_visitor &visitor) { chain.visit(visitor); }
+        void visit_deriv_parameters(parameter_visitor &visitor) { chain.visit_deriv(visitor); }
+    protected:
+        void check(const matrix_t &input) const {
+            if (input.n_rows != chain_t::input_rows || (Batch != 0 && input.n_cols != Batch))
+                throw std::invalid_argument("StaticSequence: input doesn't match the sizes of the sequence");
+        }
+    };
+}
+
+#endif /* static_hpp */
@@ -0,0 +1,195 @@
+//
+//  thread_pool.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/8/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace gnol {
+    namespace {
+        // the pool (if any) the current thread works for, and its queue
+        thread_local thread_pool *current_pool = nullptr;
+        thread_local std::size_t current_index = 0;
+    }
+
+    thread_pool::thread_pool(std::size_t threads):
+        stopping(false),
+        next_queue(0),
+        queued(0)
+    {
+        for (std::size_t i = 0; i < threads; i++)
+            queues.emplace_back(new queue());
+
+        for (std::size_t i = 0; i < threads; i++)
+            this->threads.emplace_back(&thread_pool::work, this, i);
+    }
+
+    thread_pool::~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    thread_pool &thread_pool::global() {
+        // the thread waiting on the work helps run it, so it counts as
+        // one of the cores
+        static thread_pool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+
+    void thread_pool::push(task &&t) {
+        // workers keep what they submit, everyone else spreads it around
+        const std::size_t index = current_pool == this ?
+            current_index : next_queue++ % queues.size();
+
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(t));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            ++queued;
+        }
+
+        wake.notify_one();
+    }
+
+    bool thread_pool::run_one() {
+        const std::size_t n = queues.size();
+        const bool worker = current_pool == this;
+
+        task t;
+        bool found = false;
+
+        // newest task of our own first
+        if (worker) {
+            std::lock_guard<std::mutex> lock(queues[current_index]->mutex);
+            auto &tasks = queues[current_index]->tasks;
+
+            if (!tasks.empty()) {
+                t = std::move(tasks.back());
+                tasks.pop_back();
+                found = true;
+            }
+        }
+
+        // otherwise steal the oldest task of someone else
+        const std::size_t start = worker ? current_index + 1 : 0;
+        for (std::size_t k = 0; k < n && !found; k++) {
+            auto &victim = *queues[(start + k) % n];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+
+            if (!victim.tasks.empty()) {
+                t = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                found = true;
+            }
+        }
+
+        if (!found)
+            return false;
+
+        --queued;
+
+        std::exception_ptr error;
+        try {
+            t.fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        t.group->finish(error);
+        return true;
+    }
+
+    void thread_pool::work(std::size_t index) {
+        current_pool = this;
+        current_index = index;
+
+        while (true) {
+            if (run_one())
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this]() { return stopping || queued > 0; });
+
+            if (stopping)
+                return;
+        }
+    }
+
+    task_group::task_group(thread_pool &pool):
+        pool(pool),
+        pending(0) {}
+
+    task_group::~task_group() {
+        // the tasks point back at the group, so it can't go away before
+        // they are done
+        try {
+            wait();
+        } catch (...) {}
+    }
+
+    void task_group::run(std::function<void ()> fn) {
+        ++pending;
+
+        if (pool.size() == 0) {
+            std::exception_ptr e;
+            try {
+                fn();
+            } catch (...) {
+                e = std::current_exception();
+            }
+
+            finish(e);
+            return;
+        }
+
+        pool.push({std::move(fn), this});
+    }
+
+    void task_group::wait() {
+        while (pending > 0) {
+            if (pool.run_one())
+                continue;
+
+            // everything left is already running elsewhere; check back
+            // now and then in case it queues more work we can help with
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait_for(lock, std::chrono::microseconds(100),
+                          [this]() { return pending == 0; });
+        }
+
+        // finish() holds the lock until it is done with the group
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (error) {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+    void task_group::finish(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (e && !error)
+            error = e;
+
+        if (--pending == 0)
+            done.notify_all();
+    }
+}
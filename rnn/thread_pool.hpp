@@ -0,0 +1,110 @@
+//
+//  thread_pool.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/8/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gnol {
+    class task_group;
+
+    /*!
+     A work-stealing thread pool. Every worker has its own deque of tasks:
+     it pushes and pops at the back (so nested work stays hot in its
+     cache) while idle workers steal from the front of the others.
+
+     Threads waiting on a task_group run queued tasks instead of blocking,
+     so tasks can submit and wait on tasks of their own (e.g. nested
+     ConcatModules) without starving the pool.
+     */
+    class thread_pool {
+        friend class task_group;
+
+        struct task {
+            std::function<void ()> fn;
+            task_group *group;
+        };
+
+        struct queue {
+            std::mutex mutex;
+            std::deque<task> tasks;
+        };
+
+        std::vector<std::unique_ptr<queue>> queues;
+        std::vector<std::thread> threads;
+
+        std::atomic<bool> stopping;
+        std::atomic<std::size_t> next_queue;
+
+        // number of tasks sitting in any queue, guarded by sleep_mutex
+        // when it goes up so sleeping workers can't miss it
+        std::atomic<std::size_t> queued;
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+    public:
+        // a pool of zero threads runs every task on the thread waiting
+        // for it
+        explicit thread_pool(std::size_t threads);
+        ~thread_pool();
+
+        thread_pool(const thread_pool &) = delete;
+        thread_pool &operator =(const thread_pool &) = delete;
+
+        std::size_t size() const { return threads.size(); }
+
+        // shared pool with a worker per core (besides the calling thread)
+        static thread_pool &global();
+    protected:
+        void push(task &&t);
+        bool run_one();
+        void work(std::size_t index);
+    };
+
+    /*!
+     A set of tasks that can be waited on together. An exception thrown
+     by a task is rethrown by wait().
+
+     \code
+     task_group group;
+     for (auto &branch : branches)
+        group.run([&branch]() { branch.compute(); });
+     group.wait();
+     */
+    class task_group {
+        friend class thread_pool;
+
+        thread_pool &pool;
+        std::atomic<std::size_t> pending;
+
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    public:
+        task_group(thread_pool &pool=thread_pool::global());
+        ~task_group();
+
+        task_group(const task_group &) = delete;
+        task_group &operator =(const task_group &) = delete;
+
+        void run(std::function<void ()> fn);
+        void wait();
+    protected:
+        void finish(std::exception_ptr e);
+    };
+}
+
+#endif /* thread_pool_hpp */
@@ -0,0 +1,189 @@
+//
+//  trainer.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/9/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "trainer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace gnol {
+    namespace {
+        // columns [first, last) of m, without a copy
+        const matrix_t columns(const matrix_t &m, std::size_t first, std::size_t last) {
+            return matrix_t(const_cast<real_t *>(m.colptr(first)), m.n_rows, last - first, false, true);
+        }
+
+        /*!
+         values -= rate*grads, one relaxed atomic load and store per value
+         so racing writers never tear a value (see HogwildTrainer).
+         */
+        void apply_relaxed(real_t *values, const real_t *grads, std::size_t n, real_t rate) {
+            for (std::size_t i = 0; i < n; i++) {
+                real_t value;
+                __atomic_load(values + i, &value, __ATOMIC_RELAXED);
+                value -= rate*grads[i];
+                __atomic_store(values + i, &value, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    ReplicatedTrainer::ReplicatedTrainer(factory_t factory,
+                                         std::size_t num_replicas,
+                                         criterion_factory_t criterion,
+                                         thread_pool &pool):
+        pool(pool),
+        replicas(std::max<std::size_t>(num_replicas, 1))
+    {
+        for (auto &r : replicas) {
+            r.model = factory();
+            r.criterion = criterion();
+            r.loss = 0;
+        }
+
+        params.reset(new parameter_arena(get_model()));
+
+        for (std::size_t i = 1; i < replicas.size(); i++)
+            tie_parameters(*replicas[i].model, get_model());
+
+        for (auto &r : replicas) {
+            r.grads.reset(new parameter_arena(*r.model, parameter_arena::gradients));
+
+            // updates walk the parameters and gradients side by side
+            if (r.grads->size() != params->size())
+                throw std::invalid_argument("ReplicatedTrainer: parameters and gradients don't line up");
+        }
+    }
+
+    real_t ReplicatedTrainer::run(replica &r, const matrix_t &input, const matrix_t &target,
+                                  std::size_t first, std::size_t last)
+    {
+        r.model->clear();
+        r.grads->clear();
+
+        if (first == last)
+            return 0;
+
+        const matrix_t in = columns(input, first, last);
+        const matrix_t expected = columns(target, first, last);
+
+        matrix_t &output = r.model->forward(in);
+        real_t loss = r.criterion->forward(output, expected);
+        r.model->backward(in, r.criterion->backward(output, expected));
+
+        return loss;
+    }
+
+    DataParallelTrainer::DataParallelTrainer(factory_t factory,
+                                             std::size_t num_replicas,
+                                             criterion_factory_t criterion,
+                                             thread_pool &pool):
+        ReplicatedTrainer(factory, num_replicas, criterion, pool) {}
+
+    real_t DataParallelTrainer::accumulate(const matrix_t &input, const matrix_t &target) {
+        const std::size_t n = input.n_cols;
+        const std::size_t active = std::max<std::size_t>(std::min(replicas.size(), n), 1);
+
+        task_group group(pool);
+        for (std::size_t k = 0; k < active; k++) {
+            // an even share of the columns for every replica
+            const std::size_t first = k*n/active;
+            const std::size_t last = (k + 1)*n/active;
+
+            group.run([this, &input, &target, k, first, last]() {
+                replicas[k].loss = run(replicas[k], input, target, first, last);
+            });
+        }
+        group.wait();
+
+        reduce(active);
+
+        real_t loss = 0;
+        for (std::size_t k = 0; k < active; k++)
+            loss += replicas[k].loss;
+
+        return loss;
+    }
+
+    real_t DataParallelTrainer::train(const matrix_t &input, const matrix_t &target, real_t rate) {
+        real_t loss = accumulate(input, target);
+
+        real_t *values = params->data();
+        const real_t *grads = get_gradients().data();
+        for (std::size_t i = 0; i < params->size(); i++)
+            values[i] -= rate*grads[i];
+
+        return loss;
+    }
+
+    real_t DataParallelTrainer::train(const matrix_t &input, const matrix_t &target, Optimizer &optimizer) {
+        real_t loss = accumulate(input, target);
+        optimizer.step();
+        return loss;
+    }
+
+    void DataParallelTrainer::reduce(std::size_t active) {
+        const std::size_t length = get_gradients().size();
+
+        task_group group(pool);
+        for (std::size_t begin = 0; begin < length; begin += reduce_block) {
+            const std::size_t end = std::min<std::size_t>(length, begin + reduce_block);
+
+            // every level of the tree for one block, so the block is
+            // still in cache when the next level reads it
+            group.run([this, active, begin, end]() {
+                for (std::size_t stride = 1; stride < active; stride *= 2) {
+                    for (std::size_t i = 0; i + stride < active; i += 2*stride) {
+                        real_t *sum = replicas[i].grads->data();
+                        const real_t *other = replicas[i + stride].grads->data();
+
+                        for (std::size_t j = begin; j < end; j++)
+                            sum[j] += other[j];
+                    }
+                }
+            });
+        }
+        group.wait();
+    }
+
+    HogwildTrainer::HogwildTrainer(factory_t factory,
+                                   std::size_t num_workers,
+                                   criterion_factory_t criterion,
+                                   thread_pool &pool):
+        ReplicatedTrainer(factory, num_workers, criterion, pool),
+        flush_interval(1) {}
+
+    real_t HogwildTrainer::train(const matrix_t &input, const matrix_t &target, real_t rate) {
+        const std::size_t n = input.n_cols;
+        const std::size_t workers = std::max<std::size_t>(std::min(replicas.size(), n), 1);
+
+        task_group group(pool);
+        for (std::size_t k = 0; k < workers; k++) {
+            const std::size_t first = k*n/workers;
+            const std::size_t last = (k + 1)*n/workers;
+
+            group.run([this, &input, &target, rate, k, first, last]() {
+                replica &r = replicas[k];
+                r.loss = 0;
+
+                for (std::size_t i = first; i < last; i += flush_interval) {
+                    const std::size_t end = std::min(last, i + flush_interval);
+                    r.loss += run(r, input, target, i, end);
+
+                    apply_relaxed(params->data(), r.grads->data(), params->size(), rate);
+                }
+            });
+        }
+        group.wait();
+
+        real_t loss = 0;
+        for (std::size_t k = 0; k < workers; k++)
+            loss += replicas[k].loss;
+
+        return loss;
+    }
+}
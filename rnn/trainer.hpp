@@ -0,0 +1,162 @@
+//
+//  trainer.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/9/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef trainer_hpp
+#define trainer_hpp
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "module.hpp"
+#include "criterion.hpp"
+#include "arena.hpp"
+#include "thread_pool.hpp"
+#include "optimizer.hpp"
+
+namespace gnol {
+    /*!
+     Common part of the trainers below: a set of replicas of a model, built
+     by a factory, that share the parameters of the first one (the model)
+     but each accumulate their gradients into their own contiguous buffer.
+     
+     The factory has to build the same network, with its own parameters
+     and gradients, every time it is called.
+     */
+    class ReplicatedTrainer {
+    public:
+        typedef std::shared_ptr<GradientModule> module_ptr;
+        typedef std::function<module_ptr ()> factory_t;
+        typedef std::function<std::shared_ptr<Criterion> ()> criterion_factory_t;
+    protected:
+        struct replica {
+            module_ptr model;
+            std::shared_ptr<Criterion> criterion;
+            std::unique_ptr<parameter_arena> grads;
+            real_t loss;
+        };
+        
+        thread_pool &pool;
+        std::vector<replica> replicas;
+        std::unique_ptr<parameter_arena> params;
+        
+        ReplicatedTrainer(factory_t factory,
+                          std::size_t num_replicas,
+                          criterion_factory_t criterion,
+                          thread_pool &pool);
+    public:
+        // the model every replica shares its parameters with
+        GradientModule &get_model() { return *replicas.front().model; }
+        std::size_t size() const { return replicas.size(); }
+        
+        parameter_arena &get_parameters() { return *params; }
+        
+        static std::shared_ptr<Criterion> default_criterion() {
+            return std::make_shared<L2Loss>();
+        }
+    protected:
+        // clears the replica's gradients and accumulates those of the
+        // given columns into them, returning their loss
+        real_t run(replica &r, const matrix_t &input, const matrix_t &target,
+                   std::size_t first, std::size_t last);
+    };
+    
+    /*!
+     DataParallelTrainer splits each minibatch across replicas that run on
+     separate threads, so no two threads ever write to the same gradient.
+     The gradients of the replicas are then summed into the model's
+     gradients by a parallel tree reduction, which works through the
+     buffers a block at a time so each block stays in cache for every
+     level of the tree.
+     
+     \code
+     DataParallelTrainer trainer([]() {
+        return make_sequence({
+            make_module<LinearModule>(size(100, 50)),
+            make_module<SigmoidModule>(50)
+        });
+     });
+     
+     for (auto &batch : batches)
+        trainer.train(batch.input, batch.target, 0.01);
+     */
+    class DataParallelTrainer: public ReplicatedTrainer {
+    public:
+        // number of values each task of the reduction sums
+        static const std::size_t reduce_block = 1 << 14;
+        
+        DataParallelTrainer(factory_t factory,
+                            std::size_t num_replicas=thread_pool::global().size() + 1,
+                            criterion_factory_t criterion=default_criterion,
+                            thread_pool &pool=thread_pool::global());
+        
+        parameter_arena &get_gradients() { return *replicas.front().grads; }
+        
+        /*!
+         Runs forward and backward over the batch (one sample per column)
+         and leaves the gradient of the summed loss in get_gradients().
+         Returns the summed loss.
+         */
+        real_t accumulate(const matrix_t &input, const matrix_t &target);
+        
+        // accumulate() followed by a gradient descent step
+        real_t train(const matrix_t &input, const matrix_t &target, real_t rate);
+        
+        // accumulate() followed by a step of optimizer, which has to be
+        // built on get_parameters() and get_gradients()
+        real_t train(const matrix_t &input, const matrix_t &target, Optimizer &optimizer);
+    protected:
+        void reduce(std::size_t active);
+    };
+    
+    /*!
+     HogwildTrainer trains without any synchronization between its workers
+     (Hogwild!, Niu et al. 2011). Each worker runs forward and backward on
+     its own share of the samples, accumulating into its own gradients,
+     and every flush interval applies them straight to the shared
+     parameters without taking a lock.
+     
+     The updates are relaxed atomic loads and stores of each value, so a
+     value is never torn, but an update can be lost when two workers write
+     the same value at once, and forward and backward read the parameters
+     while other workers write them. Both are the benign races Hogwild
+     relies on; they only cost a little progress when updates are sparse
+     or small. The flush interval bounds how stale a worker's gradient can
+     get: larger intervals mean fewer writes to shared memory (and less
+     contention) but gradients computed from older parameters.
+     
+     \code
+     HogwildTrainer trainer(make_autoencoder);
+     trainer.set_flush_interval(8);
+     
+     for (std::size_t epoch = 0; epoch < 10; epoch++)
+        trainer.train(data, data, 0.01);
+     */
+    class HogwildTrainer: public ReplicatedTrainer {
+        std::size_t flush_interval;
+    public:
+        HogwildTrainer(factory_t factory,
+                       std::size_t num_workers=thread_pool::global().size() + 1,
+                       criterion_factory_t criterion=default_criterion,
+                       thread_pool &pool=thread_pool::global());
+        
+        // number of samples a worker accumulates before applying them
+        void set_flush_interval(std::size_t samples) { flush_interval = std::max<std::size_t>(samples, 1); }
+        std::size_t get_flush_interval() const { return flush_interval; }
+        
+        /*!
+         Makes a pass over the samples (one per column), each worker
+         taking a contiguous share of them. Returns the summed loss, as
+         measured before each update.
+         */
+        real_t train(const matrix_t &input, const matrix_t &target, real_t rate);
+    };
+}
+
+#endif /* trainer_hpp */
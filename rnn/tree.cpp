@@ -0,0 +1,302 @@
+//
+//  tree.cpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/12/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#include "tree.hpp"
+#include "arena.hpp"
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <stdexcept>
+
+namespace gnol {
+    std::size_t tree_batch::add_leaf(std::size_t column) {
+        nodes.push_back({none, none, 0, column, 0});
+        return nodes.size() - 1;
+    }
+
+    std::size_t tree_batch::add_node(std::size_t left, std::size_t right, std::size_t kind) {
+        if (left >= nodes.size() || right >= nodes.size())
+            throw std::invalid_argument("tree_batch: children have to be added before their parent");
+
+        const std::size_t height = std::max(nodes[left].height, nodes[right].height) + 1;
+        nodes.push_back({left, right, kind, none, height});
+        return nodes.size() - 1;
+    }
+
+    TreeBatcher::TreeBatcher(std::vector<factory_t> composers):
+        factories(composers),
+        instances(composers.size()),
+        n(0),
+        trees(nullptr),
+        num_leaves(0)
+    {
+        for (std::size_t kind = 0; kind < factories.size(); kind++) {
+            auto composer = factories[kind]();
+
+            if (kind == 0)
+                n = composer->get_output_size()[0];
+
+            if (composer->get_output_size()[0] != n || composer->get_input_size()[0] != 2*n)
+                throw std::invalid_argument("TreeBatcher: composers have to map 2n values to n");
+
+            instances[kind].push_back(composer);
+        }
+    }
+
+    TreeBatcher::module_ptr TreeBatcher::instance(std::size_t kind, std::size_t index) {
+        auto &pool = instances[kind];
+
+        while (pool.size() <= index) {
+            auto composer = factories[kind]();
+            tie_parameters(*composer, *pool.front());
+            tie_parameters(*composer, *pool.front(), parameter_arena::gradients);
+            pool.push_back(composer);
+        }
+
+        return pool[index];
+    }
+
+    void TreeBatcher::visit_parameters(parameter_visitor &visitor) {
+        for (auto &pool : instances) {
+            for (auto &composer : pool)
+                composer->visit_parameters(visitor);
+        }
+    }
+
+    void TreeBatcher::visit_deriv_parameters(parameter_visitor &visitor) {
+        for (auto &pool : instances) {
+            for (auto &composer : pool)
+                composer->visit_deriv_parameters(visitor);
+        }
+    }
+
+    parameter_arena TreeBatcher::make_arena(parameter_arena::kind_t kind) {
+        // the instances alias the first, so the arena moves them together
+        return parameter_arena([this, kind](parameter_visitor &visitor) {
+            if (kind == parameter_arena::parameters)
+                visit_parameters(visitor);
+            else
+                visit_deriv_parameters(visitor);
+        });
+    }
+
+    void TreeBatcher::clear() {
+        for (auto &pool : instances) {
+            for (auto &composer : pool)
+                composer->clear();
+        }
+    }
+
+    const matrix_t &TreeBatcher::forward(const tree_batch &trees, const matrix_t &leaves) {
+        this->trees = &trees;
+        num_leaves = leaves.n_cols;
+
+        // nodes grouped by height and then kind, so every group only
+        // depends on the groups before it
+        std::map<std::pair<std::size_t, std::size_t>, std::vector<std::size_t>> groups;
+        for (std::size_t i = 0; i < trees.size(); i++) {
+            if (!trees[i].is_leaf())
+                groups[std::make_pair(trees[i].height, trees[i].kind)].push_back(i);
+        }
+
+        values.set_size(n, trees.size());
+        for (std::size_t i = 0; i < trees.size(); i++) {
+            if (trees[i].is_leaf())
+                values.col(i) = leaves.col(trees[i].column);
+        }
+
+        levels.clear();
+        std::vector<std::size_t> used(factories.size(), 0);
+
+        for (auto &group : groups) {
+            const std::size_t kind = group.first.second;
+
+            levels.push_back(level());
+            level &l = levels.back();
+            l.kind = kind;
+            l.composer = instance(kind, used[kind]++);
+            l.nodes = std::move(group.second);
+
+            // gather the children of every node into one batch
+            l.input.set_size(2*n, l.nodes.size());
+            for (std::size_t b = 0; b < l.nodes.size(); b++) {
+                const auto &node = trees[l.nodes[b]];
+                std::copy(values.colptr(node.left), values.colptr(node.left) + n, l.input.colptr(b));
+                std::copy(values.colptr(node.right), values.colptr(node.right) + n, l.input.colptr(b) + n);
+            }
+
+            // and scatter the results back
+            const matrix_t &output = l.composer->forward(l.input);
+            for (std::size_t b = 0; b < l.nodes.size(); b++)
+                std::copy(output.colptr(b), output.colptr(b) + n, values.colptr(l.nodes[b]));
+        }
+
+        return values;
+    }
+
+    const matrix_t &TreeBatcher::backward(const matrix_t &grad_nodes) {
+        const tree_batch &trees = *this->trees;
+        grad_values = grad_nodes;
+
+        // a node's gradient is complete once every level above it is done
+        matrix_t grad_output;
+        for (auto l = levels.rbegin(); l != levels.rend(); ++l) {
+            grad_output.set_size(n, l->nodes.size());
+            for (std::size_t b = 0; b < l->nodes.size(); b++) {
+                const real_t *grad = grad_values.colptr(l->nodes[b]);
+                std::copy(grad, grad + n, grad_output.colptr(b));
+            }
+
+            const matrix_t &grad_input = l->composer->backward(l->input, grad_output);
+
+            for (std::size_t b = 0; b < l->nodes.size(); b++) {
+                const auto &node = trees[l->nodes[b]];
+                const real_t *grad = grad_input.colptr(b);
+                real_t *left = grad_values.colptr(node.left);
+                real_t *right = grad_values.colptr(node.right);
+
+                for (std::size_t i = 0; i < n; i++) {
+                    left[i] += grad[i];
+                    right[i] += grad[n + i];
+                }
+            }
+        }
+
+        grad_leaves.zeros(n, num_leaves);
+        for (std::size_t i = 0; i < trees.size(); i++) {
+            if (trees[i].is_leaf())
+                grad_leaves.col(trees[i].column) += grad_values.col(i);
+        }
+
+        return grad_leaves;
+    }
+
+    GreedyMerger::GreedyMerger(module_ptr encoder, module_ptr decoder):
+        encoder(encoder),
+        decoder(decoder),
+        n(encoder->get_output_size()[0]),
+        scored(0)
+    {
+        if (encoder->get_input_size()[0] != 2*n ||
+            decoder->get_input_size()[0] != n ||
+            decoder->get_output_size()[0] != 2*n)
+        {
+            throw std::invalid_argument("GreedyMerger: encoder has to map 2n values to n and decoder n to 2n");
+        }
+    }
+
+    namespace {
+        struct candidate {
+            real_t score;
+            std::size_t left;
+            std::size_t version;
+            std::size_t slot;
+
+            // lowest score first
+            bool operator <(const candidate &other) const { return score > other.score; }
+        };
+    }
+
+    std::size_t GreedyMerger::build(const matrix_t &sentence, tree_batch &trees, std::size_t column_offset) {
+        const std::size_t none = tree_batch::none;
+        const std::size_t words = sentence.n_cols;
+        const std::size_t total = 2*words - 1;
+
+        scored = 0;
+        if (words == 0)
+            throw std::invalid_argument("GreedyMerger: empty sentence");
+
+        // the current sequence of nodes is a linked list; a node's
+        // version changes whenever its right neighbour does, which makes
+        // any queued pair starting at it stale
+        std::vector<std::size_t> prev(total, none), next(total, none), ids(total), version(total, 0);
+        std::vector<bool> alive(total, false);
+
+        matrix_t values(n, total);
+        for (std::size_t i = 0; i < words; i++) {
+            ids[i] = trees.add_leaf(column_offset + i);
+            values.col(i) = sentence.col(i);
+            alive[i] = true;
+            prev[i] = i > 0 ? i - 1 : none;
+            next[i] = i + 1 < words ? i + 1 : none;
+        }
+
+        // the encoding of every pair scored, kept for when it is merged
+        matrix_t parents(n, 3*words);
+        std::priority_queue<candidate> queue;
+        matrix_t input;
+
+        auto score = [&](const std::vector<std::size_t> &lefts) {
+            if (lefts.empty())
+                return;
+
+            input.set_size(2*n, lefts.size());
+            for (std::size_t j = 0; j < lefts.size(); j++) {
+                input.col(j).rows(0, n-1) = values.col(lefts[j]);
+                input.col(j).rows(n, 2*n-1) = values.col(next[lefts[j]]);
+            }
+
+            const matrix_t &encoded = encoder->forward(input);
+            const matrix_t &decoded = decoder->forward(encoded);
+            rowvec errors = 0.5*sum(square(decoded - input), 0);
+
+            for (std::size_t j = 0; j < lefts.size(); j++) {
+                parents.col(scored) = encoded.col(j);
+                queue.push({errors[j], lefts[j], version[lefts[j]], scored});
+                scored++;
+            }
+        };
+
+        std::vector<std::size_t> lefts;
+        for (std::size_t i = 0; i + 1 < words; i++)
+            lefts.push_back(i);
+        score(lefts);
+
+        std::size_t root = 0;
+        std::size_t count = words;
+
+        while (!queue.empty()) {
+            candidate best = queue.top();
+            queue.pop();
+
+            if (!alive[best.left] || version[best.left] != best.version)
+                continue;
+
+            const std::size_t left = best.left;
+            const std::size_t right = next[left];
+            const std::size_t parent = count++;
+
+            values.col(parent) = parents.col(best.slot);
+            ids[parent] = trees.add_node(ids[left], ids[right]);
+            root = parent;
+
+            alive[left] = alive[right] = false;
+            alive[parent] = true;
+
+            prev[parent] = prev[left];
+            next[parent] = next[right];
+
+            lefts.clear();
+            if (prev[parent] != none) {
+                next[prev[parent]] = parent;
+                version[prev[parent]]++;
+                lefts.push_back(prev[parent]);
+            }
+
+            if (next[parent] != none) {
+                prev[next[parent]] = parent;
+                lefts.push_back(parent);
+            }
+
+            score(lefts);
+        }
+
+        return ids[root];
+    }
+}
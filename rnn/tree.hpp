@@ -0,0 +1,190 @@
+//
+//  tree.hpp
+//  rnn
+//
+//  Created by Abe Schneider on 10/12/15.
+//  Copyright © 2015 Abraham Schneider. All rights reserved.
+//
+
+#ifndef tree_hpp
+#define tree_hpp
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "module.hpp"
+#include "arena.hpp"
+
+namespace gnol {
+    /*!
+     A batch of binary trees, stored as a flat list of nodes. Leaves refer
+     to a column of the leaf matrix given to TreeBatcher::forward(), and
+     every other node combines two earlier nodes with the composer of its
+     kind. Nodes are numbered in the order they are added.
+
+     \code
+     // ((a b) (c d)) and (e f)
+     tree_batch trees;
+     auto ab = trees.add_node(trees.add_leaf(0), trees.add_leaf(1));
+     auto cd = trees.add_node(trees.add_leaf(2), trees.add_leaf(3));
+     trees.add_node(ab, cd);
+     trees.add_node(trees.add_leaf(4), trees.add_leaf(5));
+     */
+    class tree_batch {
+    public:
+        static const std::size_t none = std::size_t(-1);
+
+        struct node {
+            std::size_t left, right;
+            std::size_t kind;
+
+            // column of the leaf matrix, for leaves
+            std::size_t column;
+
+            // 0 for leaves, otherwise one more than the higher child
+            std::size_t height;
+
+            bool is_leaf() const { return left == none; }
+        };
+    protected:
+        std::vector<node> nodes;
+    public:
+        std::size_t add_leaf(std::size_t column);
+        std::size_t add_node(std::size_t left, std::size_t right, std::size_t kind=0);
+
+        std::size_t size() const { return nodes.size(); }
+        const node &operator [](std::size_t index) const { return nodes[index]; }
+
+        void clear() { nodes.clear(); }
+    };
+
+    /*!
+     TreeBatcher runs recursive networks over a batch of trees. Rather than
+     running a composer once per node, it groups the nodes of every tree
+     that sit at the same height (so their children are ready at the same
+     time) and share the same composer, and runs each group as a single
+     batched forward and backward, i.e. one matrix product per layer of the
+     composer instead of one matrix-vector product per node.
+
+     Each composer maps the two child representations (stacked, 2n rows)
+     to the representation of the node (n rows). Every group keeps the
+     state its backward needs in its own instance of the composer; the
+     instances share the parameters and gradients of the first, which is
+     what get_composer() returns.
+
+     As the instances point at the storage of the first, that storage
+     mustn't be moved on its own: build arenas (and so optimizers) with
+     make_arena(), which moves every instance along, rather than on
+     get_composer().
+
+     \code
+     TreeBatcher batcher({factory});
+     SGDOptimizer sgd(batcher.make_arena(),
+                      batcher.make_arena(parameter_arena::gradients), 0.1);
+     */
+    class TreeBatcher {
+    public:
+        typedef std::shared_ptr<GradientModule> module_ptr;
+        typedef std::function<module_ptr ()> factory_t;
+    protected:
+        struct level {
+            std::size_t kind;
+            module_ptr composer;
+            std::vector<std::size_t> nodes;
+            matrix_t input;
+        };
+
+        std::vector<factory_t> factories;
+        std::vector<std::vector<module_ptr>> instances;
+        std::size_t n;
+
+        const tree_batch *trees;
+        std::vector<level> levels;
+        std::size_t num_leaves;
+
+        matrix_t values;
+        matrix_t grad_values;
+        matrix_t grad_leaves;
+    public:
+        // one factory for each kind of node
+        TreeBatcher(std::vector<factory_t> composers);
+
+        GradientModule &get_composer(std::size_t kind=0) { return *instances[kind].front(); }
+
+        // the parameters (or gradients) of every instance of every composer
+        void visit_parameters(parameter_visitor &visitor);
+        void visit_deriv_parameters(parameter_visitor &visitor);
+
+        parameter_arena make_arena(parameter_arena::kind_t kind=parameter_arena::parameters);
+
+        // number of batched calls the last forward made
+        std::size_t num_levels() const { return levels.size(); }
+
+        /*!
+         Computes every node of trees, returning a matrix with the
+         representation of node i in column i. trees has to outlive the
+         following call to backward().
+         */
+        const matrix_t &forward(const tree_batch &trees, const matrix_t &leaves);
+
+        /*!
+         Takes the gradient of the loss with respect to each node (one
+         column per node), accumulates the gradients of the composers and
+         returns the gradient with respect to the leaf matrix.
+         */
+        const matrix_t &backward(const matrix_t &grad_nodes);
+
+        // zeros the gradients of the composers
+        void clear();
+    protected:
+        module_ptr instance(std::size_t kind, std::size_t index);
+    };
+
+    /*!
+     GreedyMerger builds the tree of a sentence the way a recursive
+     autoencoder does: it repeatedly merges the adjacent pair whose
+     encoding (encoder: 2n to n) the decoder (n to 2n) reconstructs best.
+     
+     Pair scores are kept in a priority queue. A merge only changes the
+     pairs on either side of it, so only those (at most two) are scored
+     again, in a single batched call, and pairs made stale by a merge are
+     skipped when they come up. All the pairs of the sentence are scored
+     together up front, so a sentence of L words costs at most 3(L-1)
+     encoder columns, instead of the O(L^2) of rescoring every pair after
+     every merge.
+     
+     \code
+     GreedyMerger merger(encoder, decoder);
+     
+     tree_batch trees;
+     std::size_t offset = 0;
+     for (auto &sentence : sentences) {
+        merger.build(sentence, trees, offset);
+        offset += sentence.n_cols;
+     }
+     
+     // train on the trees with a TreeBatcher
+     */
+    class GreedyMerger {
+    public:
+        typedef std::shared_ptr<GradientModule> module_ptr;
+    protected:
+        module_ptr encoder, decoder;
+        std::size_t n;
+        std::size_t scored;
+    public:
+        GreedyMerger(module_ptr encoder, module_ptr decoder);
+        
+        /*!
+         Adds the tree of sentence (one word per column) to trees, with
+         word i as leaf column column_offset + i, and returns its root.
+         */
+        std::size_t build(const matrix_t &sentence, tree_batch &trees, std::size_t column_offset=0);
+        
+        // number of pairs the encoder was run on by the last build()
+        std::size_t num_scored() const { return scored; }
+    };
+}
+
+#endif /* tree_hpp */
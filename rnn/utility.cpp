@@ -8,6 +8,9 @@
 
 #include "utility.hpp"
 
+#include <algorithm>
+#include <cstdlib>
+
 namespace gnol {
     parameter_list empty_parameter_list;
     
@@ -21,4 +24,12 @@ namespace gnol {
         
         return std::move(joined);
     }
-}
\ No newline at end of file
+    
+    std::shared_ptr<real_t> allocate_aligned(std::size_t length, std::size_t alignment) {
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, alignment, std::max<std::size_t>(length, 1)*sizeof(real_t)) != 0)
+            throw std::bad_alloc();
+        
+        return std::shared_ptr<real_t>(static_cast<real_t *>(ptr), std::free);
+    }
+}
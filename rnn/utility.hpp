@@ -11,6 +11,8 @@
 
 #include <list>
 #include <array>
+#include <memory>
+#include <new>
 
 #include <boost/range.hpp>
 #include <boost/optional.hpp>
@@ -28,6 +30,18 @@ namespace gnol {
     
     extern parameter_list empty_parameter_list;
     
+    template <typename MatrixT> class variable;
+    
+    /*!
+     Visits the storage of every parameter of a module (rather than a
+     range over its values), so the storage itself can be moved. Storage
+     shared between modules is visited once per module sharing it.
+     */
+    struct parameter_visitor {
+        virtual void operator ()(variable<matrix_t> &param) = 0;
+        virtual void operator ()(variable<vector_t> &param) = 0;
+    };
+    
     class size_t;
     
     template <std::size_t D>
@@ -246,6 +260,50 @@ namespace gnol {
         
         const MatrixT &operator *() const { return *value; }
         std::shared_ptr<const MatrixT> operator ->() const { return value; }
+        
+        // number of variables sharing the storage, this one included
+        long use_count() const { return value.use_count(); }
+        
+        /*!
+         Points the variable, and every variable sharing it, at external
+         memory of the same shape. The memory is not copied or owned, so it
+         must outlive the variable. A strict view cannot be resized.
+         */
+        void rebind(element_t *memory, bool strict=true) {
+            rebind(memory, value->n_rows, value->n_cols, strict);
+        }
+        
+        void rebind(element_t *memory, uword rows, uword cols, bool strict) {
+            // the matrix is replaced in place (rather than swapping the
+            // pointer) so that shared copies see the new storage
+            value->~MatrixT();
+            construct_view(value.get(), memory, rows, cols, strict);
+        }
+        
+        // gives a rebound variable its own copy of its values again
+        void detach() {
+            MatrixT copy(*value);
+            value->~MatrixT();
+            new (value.get()) MatrixT(copy);
+        }
+        
+        // leaves the variable empty and on its own; the storage goes
+        // once no other variable shares it
+        void release() {
+            value = std::make_shared<MatrixT>();
+        }
+    private:
+        static void construct_view(Mat<element_t> *where, element_t *memory,
+                                   uword rows, uword cols, bool strict)
+        {
+            new (where) Mat<element_t>(memory, rows, cols, false, strict);
+        }
+        
+        static void construct_view(Col<element_t> *where, element_t *memory,
+                                   uword rows, uword, bool strict)
+        {
+            new (where) Col<element_t>(memory, rows, false, strict);
+        }
     };
     
     template <typename MatrixT>
@@ -286,6 +344,10 @@ namespace gnol {
     }
     
     vector_t concat(std::initializer_list<vector_t> &&lst);
+    
+    // uninitialized storage for length values, with its start aligned to
+    // alignment bytes
+    std::shared_ptr<real_t> allocate_aligned(std::size_t length, std::size_t alignment=64);
 }
 
 #endif